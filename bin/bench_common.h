@@ -0,0 +1,283 @@
+#pragma once
+
+#include "../lib/MemoryPoolAllocator.h"
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// shared helpers of the benchmark and tool executables
+
+// one bucket of a pool given on the command line as
+// <block_size>:<block_count>[:<policy>]
+struct pool_spec {
+    size_t block_size{0};
+    size_t block_count{0};
+    bucket_policy policy{bucket_policy::first_fit};
+    commit_options commit{};
+};
+
+inline const char* policy_name(bucket_policy policy) {
+    switch (policy) {
+        case bucket_policy::first_fit: return "first_fit";
+        case bucket_policy::next_fit: return "next_fit";
+        case bucket_policy::bump: return "bump";
+    }
+    return "unknown";
+}
+
+inline bucket_policy parse_policy(const std::string& text) {
+    for (auto policy : {bucket_policy::first_fit, bucket_policy::next_fit, bucket_policy::bump}) {
+        if (text == policy_name(policy)) {
+            return policy;
+        }
+    }
+    throw std::invalid_argument("unknown bucket policy " + text);
+}
+
+inline const char* commit_mode_name(commit_mode mode) {
+    switch (mode) {
+        case commit_mode::zero: return "zero";
+        case commit_mode::lazy: return "lazy";
+        case commit_mode::populate: return "populate";
+        case commit_mode::touch: return "touch";
+    }
+    return "unknown";
+}
+
+inline commit_mode parse_commit_mode(const std::string& text) {
+    for (auto mode : {commit_mode::zero, commit_mode::lazy, commit_mode::populate, commit_mode::touch}) {
+        if (text == commit_mode_name(mode)) {
+            return mode;
+        }
+    }
+    throw std::invalid_argument("unknown commit mode " + text);
+}
+
+inline pool_spec parse_pool_spec(const std::string& text) {
+    const auto colon = text.find(':');
+    if (colon == std::string::npos) {
+        throw std::invalid_argument("bucket must be <block_size>:<block_count>[:<policy>], got " + text);
+    }
+    const auto second = text.find(':', colon + 1);
+    pool_spec spec{std::stoull(text.substr(0, colon)), std::stoull(text.substr(colon + 1, second - colon - 1))};
+    if (second != std::string::npos) {
+        spec.policy = parse_policy(text.substr(second + 1));
+    }
+    if (spec.block_size == 0 || spec.block_count == 0) {
+        throw std::invalid_argument("bucket sizes must be positive: " + text);
+    }
+    return spec;
+}
+
+// a whole pool: buckets separated by commas, e.g. 8:1000000,24:1000000
+inline std::vector<pool_spec> parse_pool_config(const std::string& text) {
+    std::vector<pool_spec> specs;
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        const auto end = std::min(text.find(',', begin), text.size());
+        specs.push_back(parse_pool_spec(text.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+    return specs;
+}
+
+inline std::string describe(const std::vector<pool_spec>& specs) {
+    std::string out;
+    for (const auto& spec : specs) {
+        if (!out.empty()) {
+            out += ' ';
+        }
+        out += std::to_string(spec.block_size) + ":" + std::to_string(spec.block_count);
+        if (spec.policy != bucket_policy::first_fit) {
+            out += std::string(":") + policy_name(spec.policy);
+        }
+    }
+    return out;
+}
+
+template<size_t... I>
+std::array<bucket, sizeof...(I)> make_pool(const std::vector<pool_spec>& specs, std::index_sequence<I...>) {
+    return {bucket(specs[I].block_size, specs[I].block_count, specs[I].policy, specs[I].commit)...};
+}
+
+// largest pool accepted from the command line, bucket_count is a template parameter
+constexpr size_t max_runtime_buckets = 6;
+
+// builds std::array<bucket, specs.size()> and calls f with it
+template<typename F>
+void with_pool(const std::vector<pool_spec>& specs, F&& f) {
+    const auto run = [&]<size_t N>() {
+        auto pool = make_pool(specs, std::make_index_sequence<N>{});
+        f(pool);
+    };
+    switch (specs.size()) {
+        case 1: run.template operator()<1>(); break;
+        case 2: run.template operator()<2>(); break;
+        case 3: run.template operator()<3>(); break;
+        case 4: run.template operator()<4>(); break;
+        case 5: run.template operator()<5>(); break;
+        case 6: run.template operator()<6>(); break;
+        default:
+            throw std::invalid_argument("pool must have 1.." + std::to_string(max_runtime_buckets) + " buckets");
+    }
+}
+
+// trace event with the object id replaced by a dense slot number
+struct replay_op {
+    size_t slot;
+    size_t size;
+    bool allocate;
+};
+
+inline std::vector<replay_op> prepare_replay(const std::vector<trace_event>& events, size_t& slot_count) {
+    std::vector<replay_op> ops;
+    ops.reserve(events.size());
+    std::unordered_map<uint64_t, size_t> slots;
+    std::vector<size_t> free_slots;
+    slot_count = 0;
+    for (const auto& event : events) {
+        if (event.kind == trace_event_kind::allocate) {
+            size_t slot;
+            if (free_slots.empty()) {
+                slot = slot_count++;
+            } else {
+                slot = free_slots.back();
+                free_slots.pop_back();
+            }
+            slots[event.object_id] = slot;
+            ops.push_back({slot, event.size, true});
+        } else if (const auto it = slots.find(event.object_id); it != slots.end()) {
+            ops.push_back({it->second, event.size, false});
+            free_slots.push_back(it->second);
+            slots.erase(it);
+        }
+    }
+    return ops;
+}
+
+// makes the compiler assume value is used, so the work producing it
+// is not optimized out
+template<typename T>
+inline void keep_result(const T& value) {
+    asm volatile("" : : "g"(value) : "memory");
+}
+
+// ru_maxrss is reported in kilobytes on Linux
+inline long peak_rss_kb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct fault_counters {
+    long minor{0};
+    long major{0};
+};
+
+inline fault_counters page_faults() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return {usage.ru_minflt, usage.ru_majflt};
+}
+
+inline fault_counters operator-(const fault_counters& lhs, const fault_counters& rhs) {
+    return {lhs.minor - rhs.minor, lhs.major - rhs.major};
+}
+
+// reads a kB field such as VmRSS or VmHWM from /proc/self/status, -1 if missing
+inline long proc_status_kb(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size(), field) == 0 && line.size() > field.size() && line[field.size()] == ':') {
+            return std::stol(line.substr(field.size() + 1));
+        }
+    }
+    return -1;
+}
+
+// hardware counter of this thread via perf_event_open
+// valid() is false when the kernel or the sandbox does not allow it
+class perf_counter {
+public:
+    perf_counter(uint32_t type, uint64_t config) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    perf_counter(const perf_counter&) = delete;
+    perf_counter& operator=(const perf_counter&) = delete;
+
+    ~perf_counter() {
+        if (valid()) {
+            close(fd_);
+        }
+    }
+
+    bool valid() const {
+        return fd_ >= 0;
+    }
+
+    void start() {
+        if (valid()) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // counted events since start, 0 when not valid
+    uint64_t stop() {
+        uint64_t value = 0;
+        if (valid()) {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd_, &value, sizeof(value)) != sizeof(value)) {
+                value = 0;
+            }
+        }
+        return value;
+    }
+
+private:
+    int fd_{-1};
+};
+
+// share of free bytes that can not be used for the longest run of their
+// bucket, each bucket weighted by its free bytes. 0 when the free memory
+// of every bucket is a single run, an empty pool included
+template<size_t N>
+double pool_fragmentation(const std::array<bucket, N>& pool) {
+    size_t free = 0;
+    size_t stranded = 0;
+    for (const auto& b : pool) {
+        const auto bucket_free = b.free_blocks() * b.BlockSize;
+        free += bucket_free;
+        stranded += bucket_free - b.largest_free_run() * b.BlockSize;
+    }
+    return free == 0 ? 0.0 : static_cast<double>(stranded) / static_cast<double>(free);
+}
+
+template<size_t N>
+size_t pool_used_bytes(const std::array<bucket, N>& pool) {
+    size_t used = 0;
+    for (const auto& b : pool) {
+        used += (b.BlockCount - b.free_blocks()) * b.BlockSize;
+    }
+    return used;
+}
@@ -0,0 +1,178 @@
+#include "bench_common.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Memory footprint and page fault cost of pool configurations
+//   footprint_bench [--objects N] [--size B] [--commit zero|lazy|populate|touch]
+//                   [--threads T] [--lock] [pool config]...
+// A pool config is a comma separated bucket list, e.g. 8:1000000,24:1000000.
+// --commit, --threads and --lock choose how the buckets commit their data
+// (commit_options), with an up front commit work_minflt should stay near 0.
+// Every configuration and the std::allocator baseline run in a forked
+// child so peak RSS and fault counts are not shared between them
+
+struct footprint {
+    double startup_ms{0};
+    long startup_rss_kb{0};
+    fault_counters startup_faults;
+    double workload_ms{0};
+    fault_counters workload_faults;
+    long peak_rss_kb{0};
+    bool failed{false};
+};
+
+struct workload {
+    size_t objects{1000000};
+    size_t size{16};
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// allocates and writes every object, frees every other one and
+// refills the holes, as a long running service would
+template<typename Allocator>
+void run_workload(Allocator& alloc, const workload& w) {
+    std::vector<uint8_t*> objects(w.objects);
+    for (auto& object : objects) {
+        object = alloc.allocate(w.size);
+        std::memset(object, 1, w.size);
+    }
+    for (size_t i = 0; i < objects.size(); i += 2) {
+        alloc.deallocate(objects[i], w.size);
+    }
+    for (size_t i = 0; i < objects.size(); i += 2) {
+        objects[i] = alloc.allocate(w.size);
+        std::memset(objects[i], 2, w.size);
+    }
+    for (auto object : objects) {
+        alloc.deallocate(object, w.size);
+    }
+}
+
+template<typename Setup>
+footprint measure(const workload& w, Setup&& setup) {
+    footprint result;
+    const auto faults_before = page_faults();
+    const auto start = std::chrono::steady_clock::now();
+    setup([&](auto& alloc) {
+        result.startup_ms = elapsed_ms(start);
+        result.startup_faults = page_faults() - faults_before;
+        result.startup_rss_kb = proc_status_kb("VmRSS");
+
+        const auto work_faults_before = page_faults();
+        const auto work_start = std::chrono::steady_clock::now();
+        run_workload(alloc, w);
+        result.workload_ms = elapsed_ms(work_start);
+        result.workload_faults = page_faults() - work_faults_before;
+    });
+    result.peak_rss_kb = proc_status_kb("VmHWM");
+    return result;
+}
+
+template<typename Setup>
+footprint measure_in_child(const workload& w, Setup&& setup) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        footprint result;
+        try {
+            result = measure(w, setup);
+        } catch (const std::exception&) {
+            result.failed = true;
+        }
+        const bool written = write(fds[1], &result, sizeof(result)) == sizeof(result);
+        _exit(written ? 0 : 1);
+    }
+    close(fds[1]);
+    footprint result;
+    if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+        result.failed = true;
+    }
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return result;
+}
+
+void print_row(const std::string& name, const footprint& f) {
+    std::cout << std::left << std::setw(36) << name << std::right;
+    if (f.failed) {
+        std::cout << "  failed (pool exhausted or mlock refused)\n";
+        return;
+    }
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(14) << f.startup_ms
+              << std::setw(14) << f.startup_rss_kb
+              << std::setw(14) << f.startup_faults.minor
+              << std::setw(14) << f.startup_faults.major
+              << std::setw(14) << f.workload_ms
+              << std::setw(14) << f.workload_faults.minor
+              << std::setw(14) << f.workload_faults.major
+              << std::setw(14) << f.peak_rss_kb << "\n";
+}
+
+int main(int argc, char** argv) {
+    workload w;
+    commit_options commit;
+    std::vector<std::vector<pool_spec>> configs;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--objects" && i + 1 < argc) {
+            w.objects = std::stoull(argv[++i]);
+        } else if (arg == "--size" && i + 1 < argc) {
+            w.size = std::stoull(argv[++i]);
+        } else if (arg == "--commit" && i + 1 < argc) {
+            commit.mode = parse_commit_mode(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            commit.threads = std::stoull(argv[++i]);
+        } else if (arg == "--lock") {
+            commit.lock = true;
+        } else {
+            configs.push_back(parse_pool_config(arg));
+        }
+    }
+    if (configs.empty()) {
+        configs.push_back({{8, 4 * w.objects}, {24, 2 * w.objects}});
+        configs.push_back({{w.size, 2 * w.objects}});
+    }
+    for (auto& config : configs) {
+        for (auto& spec : config) {
+            spec.commit = commit;
+        }
+    }
+
+    std::cout << w.objects << " objects of " << w.size << " bytes, commit "
+              << commit_mode_name(commit.mode) << (commit.lock ? " locked" : "") << "\n"
+              << std::left << std::setw(36) << "allocator" << std::right
+              << std::setw(14) << "startup_ms"
+              << std::setw(14) << "start_rss_kb"
+              << std::setw(14) << "start_minflt"
+              << std::setw(14) << "majflt"
+              << std::setw(14) << "work_ms"
+              << std::setw(14) << "work_minflt"
+              << std::setw(14) << "majflt"
+              << std::setw(14) << "peak_rss_kb" << "\n";
+
+    print_row("std::allocator", measure_in_child(w, [](auto&& run) {
+        std::allocator<uint8_t> alloc;
+        run(alloc);
+    }));
+    for (const auto& config : configs) {
+        print_row("pool " + describe(config), measure_in_child(w, [&](auto&& run) {
+            with_pool(config, [&](auto& pool) {
+                MemoryPoolAllocator<uint8_t, std::tuple_size_v<std::remove_reference_t<decltype(pool)>>> alloc(pool);
+                run(alloc);
+            });
+        }));
+    }
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include "bench_common.h"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+// Sweeps bucket layouts against a workload and prints a Pareto table
+// of throughput versus memory waste
+//   layout_sweep [--trace file] [--objects N] [--min-size B] [--max-size B]
+//                [--sizes 8,16,24,...] [--max-buckets K] [--headroom 1.5,3]
+// Every combination of up to K block sizes is tried. Each bucket gets
+// enough blocks to hold headroom times the peak live bytes of the workload.
+// Waste is info::waste summed over allocations, the same number
+// MemoryPoolAllocator::allocate minimizes, relative to the requested bytes
+
+struct sweep_settings {
+    std::string trace;
+    size_t objects{100000};
+    size_t min_size{1};
+    size_t max_size{64};
+    std::vector<size_t> sizes{8, 16, 24, 32, 48, 64};
+    size_t max_buckets{3};
+    std::vector<double> headroom{2.0};
+};
+
+struct sweep_result {
+    std::vector<pool_spec> layout;
+    double mops{0};
+    double waste{0};        // wasted / requested bytes
+    size_t pool_bytes{0};
+    size_t failed{0};
+    bool pareto{false};
+};
+
+template<typename T>
+std::vector<T> parse_list(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(static_cast<T>(std::stod(item)));
+    }
+    return values;
+}
+
+// allocations of uniformly distributed sizes, two thirds of the
+// operations allocate and the rest free a random live object
+std::vector<trace_event> synthetic_trace(const sweep_settings& s) {
+    std::mt19937_64 rng(7);
+    std::vector<trace_event> events;
+    std::vector<uint64_t> live;
+    uint64_t next_id = 0;
+    while (next_id < s.objects) {
+        trace_event event;
+        if (live.empty() || rng() % 3 != 0) {
+            event.kind = trace_event_kind::allocate;
+            event.object_id = next_id++;
+            event.size = static_cast<uint64_t>(s.min_size + rng() % (s.max_size - s.min_size + 1));
+            live.push_back(event.object_id);
+        } else {
+            const auto victim = rng() % live.size();
+            event.kind = trace_event_kind::deallocate;
+            event.object_id = live[victim];
+            live[victim] = live.back();
+            live.pop_back();
+        }
+        events.push_back(event);
+    }
+    return events;
+}
+
+size_t peak_live_bytes(const std::vector<replay_op>& ops, size_t slot_count) {
+    std::vector<size_t> sizes(slot_count, 0);
+    size_t live = 0;
+    size_t peak = 0;
+    for (const auto& op : ops) {
+        if (op.allocate) {
+            sizes[op.slot] = op.size;
+            live += op.size;
+            peak = std::max(peak, live);
+        } else {
+            live -= sizes[op.slot];
+        }
+    }
+    return peak;
+}
+
+template<size_t N>
+sweep_result run(std::array<bucket, N>& pool, const std::vector<replay_op>& ops, size_t slot_count) {
+    sweep_result result;
+    MemoryPoolAllocator<uint8_t, N> alloc(pool);
+    std::vector<uint8_t*> slots(slot_count, nullptr);
+    // pointer returned for every operation, to attribute waste afterwards
+    std::vector<uint8_t*> served(ops.size(), nullptr);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const auto& op = ops[i];
+        if (op.allocate) {
+            try {
+                slots[op.slot] = served[i] = alloc.allocate(op.size);
+            } catch (const std::bad_alloc&) {
+                ++result.failed;
+            }
+        } else if (slots[op.slot] != nullptr) {
+            alloc.deallocate(slots[op.slot], op.size);
+            slots[op.slot] = nullptr;
+        }
+    }
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.mops = static_cast<double>(ops.size()) / seconds / 1e6;
+
+    size_t requested = 0;
+    size_t wasted = 0;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (served[i] == nullptr) {
+            continue;
+        }
+        for (size_t b = 0; b < N; ++b) {
+            if (pool[b].belongs(served[i])) {
+                wasted += info::rank(b, pool[b].BlockSize, ops[i].size).waste;
+                break;
+            }
+        }
+        requested += ops[i].size;
+    }
+    result.waste = requested == 0 ? 0.0 : static_cast<double>(wasted) / static_cast<double>(requested);
+    for (const auto& b : pool) {
+        result.pool_bytes += b.BlockSize * b.BlockCount;
+    }
+    return result;
+}
+
+// every ascending combination of k sizes
+void combinations(const std::vector<size_t>& sizes, size_t k, size_t from,
+                  std::vector<size_t>& current, std::vector<std::vector<size_t>>& out) {
+    if (current.size() == k) {
+        out.push_back(current);
+        return;
+    }
+    for (size_t i = from; i < sizes.size(); ++i) {
+        current.push_back(sizes[i]);
+        combinations(sizes, k, i + 1, current, out);
+        current.pop_back();
+    }
+}
+
+int main(int argc, char** argv) {
+    sweep_settings s;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string arg = argv[i];
+        const std::string value = argv[i + 1];
+        if (arg == "--trace") {
+            s.trace = value;
+        } else if (arg == "--objects") {
+            s.objects = std::stoull(value);
+        } else if (arg == "--min-size") {
+            s.min_size = std::stoull(value);
+        } else if (arg == "--max-size") {
+            s.max_size = std::stoull(value);
+        } else if (arg == "--sizes") {
+            s.sizes = parse_list<size_t>(value);
+        } else if (arg == "--max-buckets") {
+            s.max_buckets = std::min<size_t>(std::stoull(value), max_runtime_buckets);
+        } else if (arg == "--headroom") {
+            s.headroom = parse_list<double>(value);
+        } else {
+            std::cerr << "unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+    std::sort(s.sizes.begin(), s.sizes.end());
+
+    size_t slot_count = 0;
+    const auto ops = prepare_replay(s.trace.empty() ? synthetic_trace(s) : read_trace(s.trace), slot_count);
+    const auto peak = peak_live_bytes(ops, slot_count);
+
+    std::vector<sweep_result> results;
+    for (size_t k = 1; k <= s.max_buckets; ++k) {
+        std::vector<std::vector<size_t>> layouts;
+        std::vector<size_t> current;
+        combinations(s.sizes, k, 0, current, layouts);
+        for (const auto& sizes : layouts) {
+            for (auto headroom : s.headroom) {
+                std::vector<pool_spec> layout;
+                for (auto size : sizes) {
+                    const auto blocks = static_cast<size_t>(std::ceil(headroom * static_cast<double>(peak) / static_cast<double>(size)));
+                    layout.push_back({size, std::max<size_t>(blocks, 1)});
+                }
+                with_pool(layout, [&](auto& pool) {
+                    auto result = run(pool, ops, slot_count);
+                    result.layout = layout;
+                    results.push_back(result);
+                });
+            }
+        }
+    }
+
+    // a layout is on the frontier when no other layout is at least as fast
+    // with at most the same waste and strictly better in one of them
+    for (auto& candidate : results) {
+        candidate.pareto = candidate.failed == 0 && std::none_of(results.begin(), results.end(), [&](const sweep_result& other) {
+            return other.failed == 0 && other.mops >= candidate.mops && other.waste <= candidate.waste
+                && (other.mops > candidate.mops || other.waste < candidate.waste);
+        });
+    }
+    std::sort(results.begin(), results.end(), [](const sweep_result& lhs, const sweep_result& rhs) {
+        return lhs.waste == rhs.waste ? lhs.mops > rhs.mops : lhs.waste < rhs.waste;
+    });
+
+    std::cout << ops.size() << " operations, peak live " << peak << " bytes\n"
+              << std::left << std::setw(8) << "pareto" << std::setw(48) << "layout" << std::right
+              << std::setw(10) << "Mops/s"
+              << std::setw(10) << "waste%"
+              << std::setw(14) << "pool_bytes"
+              << std::setw(8) << "failed" << "\n";
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(8) << (r.pareto ? "*" : "") << std::setw(48) << describe(r.layout) << std::right
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(10) << r.mops
+                  << std::setw(10) << 100.0 * r.waste
+                  << std::setw(14) << r.pool_bytes
+                  << std::setw(8) << r.failed << "\n";
+    }
+    return 0;
+}
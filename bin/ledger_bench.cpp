@@ -0,0 +1,144 @@
+#include "bench_common.h"
+#include <chrono>
+#include <iostream>
+#include <random>
+
+// Microbenchmarks of the ledger operations of bucket:
+// find_contiguous_blocks, set_used and set_free
+//   ledger_bench [--blocks N] [--calls C]
+// The ledger is filled to 0..99% with a random, striped or front-loaded
+// pattern and each operation is timed for run lengths 1..1024, or up to
+// N when the ledger is shorter.
+// Prints CSV: function,pattern,fill,run,ns_per_call
+
+struct ledger_access {
+    static size_t find_contiguous_blocks(const bucket& b, size_t n) {
+        return b.find_contiguous_blocks(n, 0, b.BlockCount);
+    }
+
+    static void set_used(bucket& b, size_t index, size_t n) {
+        b.set_used(index, n);
+    }
+
+    static void set_free(bucket& b, size_t index, size_t n) {
+        b.set_free(index, n);
+    }
+
+    static std::vector<uint8_t> save(const bucket& b) {
+        return {b.ledger_, b.ledger_ + ledger_size(b)};
+    }
+
+    static void restore(bucket& b, const std::vector<uint8_t>& ledger) {
+        std::memcpy(b.ledger_, ledger.data(), ledger.size());
+    }
+
+    static size_t ledger_size(const bucket& b) {
+        return bucket_ledger_size(b.BlockCount);
+    }
+};
+
+enum class fill_pattern {
+    random,         // every block used with probability fill
+    striped,        // repeating used/free stripes of 64 blocks
+    front_loaded,   // the first fill * BlockCount blocks used
+};
+
+const char* pattern_name(fill_pattern pattern) {
+    switch (pattern) {
+        case fill_pattern::random: return "random";
+        case fill_pattern::striped: return "striped";
+        case fill_pattern::front_loaded: return "front_loaded";
+    }
+    return "unknown";
+}
+
+void fill(bucket& b, fill_pattern pattern, double ratio) {
+    ledger_access::restore(b, std::vector<uint8_t>(ledger_access::ledger_size(b), 0));
+    std::mt19937_64 rng(1);
+    std::bernoulli_distribution used(ratio);
+    constexpr size_t stripe = 64;
+    const auto used_per_stripe = static_cast<size_t>(ratio * stripe);
+    const auto front = static_cast<size_t>(ratio * static_cast<double>(b.BlockCount));
+    for (size_t i = 0; i < b.BlockCount; ++i) {
+        bool set = false;
+        switch (pattern) {
+            case fill_pattern::random: set = used(rng); break;
+            case fill_pattern::striped: set = i % stripe < used_per_stripe; break;
+            case fill_pattern::front_loaded: set = i < front; break;
+        }
+        if (set) {
+            ledger_access::set_used(b, i, 1);
+        }
+    }
+}
+
+template<typename F>
+double ns_per_call(size_t calls, F&& f) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i) {
+        f(i);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+        / static_cast<double>(calls);
+}
+
+int main(int argc, char** argv) {
+    size_t blocks = 1 << 16;
+    size_t calls = 200;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string arg = argv[i];
+        if (arg == "--blocks") {
+            blocks = std::stoull(argv[i + 1]);
+        } else if (arg == "--calls") {
+            calls = std::stoull(argv[i + 1]);
+        }
+    }
+
+    if (blocks == 0) {
+        throw std::invalid_argument("--blocks must be at least 1");
+    }
+    // runs longer than the ledger have no position to be set at
+    const auto max_run = std::min<size_t>(1024, blocks);
+
+    // one byte blocks, only the ledger matters here
+    bucket b(1, blocks);
+    std::mt19937_64 rng(2);
+    size_t sink = 0;
+
+    std::cout << "function,pattern,fill,run,ns_per_call\n";
+    for (auto pattern : {fill_pattern::random, fill_pattern::striped, fill_pattern::front_loaded}) {
+        for (auto ratio : {0.0, 0.25, 0.5, 0.75, 0.9, 0.99}) {
+            fill(b, pattern, ratio);
+            const auto ledger = ledger_access::save(b);
+            for (size_t run = 1; run <= max_run; run *= 2) {
+                const auto prefix = [&](const char* function) {
+                    std::cout << function << "," << pattern_name(pattern) << "," << ratio << "," << run << ",";
+                };
+
+                prefix("find_contiguous_blocks");
+                std::cout << ns_per_call(calls, [&](size_t) {
+                    sink += ledger_access::find_contiguous_blocks(b, run);
+                }) << "\n";
+
+                // the bit operations do not depend on the ledger contents,
+                // positions are random and the ledger is restored afterwards
+                std::vector<size_t> positions(calls);
+                for (auto& position : positions) {
+                    position = rng() % (blocks - run + 1);
+                }
+                prefix("set_used");
+                std::cout << ns_per_call(calls, [&](size_t i) {
+                    ledger_access::set_used(b, positions[i], run);
+                }) << "\n";
+                prefix("set_free");
+                std::cout << ns_per_call(calls, [&](size_t i) {
+                    ledger_access::set_free(b, positions[i], run);
+                }) << "\n";
+                ledger_access::restore(b, ledger);
+            }
+        }
+    }
+    // keeps the searches from being optimized out
+    keep_result(sink);
+    return 0;
+}
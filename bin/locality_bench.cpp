@@ -0,0 +1,193 @@
+#include "bench_common.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <random>
+
+// Traversal speed of node containers after allocator churn
+//   locality_bench [--nodes N] [--churn R] [--passes P] [pool config]...
+// Each container is filled with N nodes, then R * N times a random node
+// is erased and a new one inserted at a random position, then it is
+// traversed P times. Reported per node: traversal time, cache misses
+// (when perf events are available) and how often the next node lies
+// within a cache line of the current one
+
+struct settings {
+    size_t nodes{200000};
+    double churn{1.0};
+    size_t passes{10};
+};
+
+struct locality {
+    double build_ms{0};
+    double churn_ms{0};
+    double ns_per_node{0};
+    double misses_per_node{-1};
+    double adjacent{0};     // share of successors within 64 bytes
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+template<typename Container>
+locality traverse(const Container& container, const settings& s, locality result) {
+    size_t near = 0;
+    const uint8_t* previous = nullptr;
+    for (const auto& value : container) {
+        const auto current = reinterpret_cast<const uint8_t*>(&value);
+        if (previous != nullptr && (current > previous ? current - previous : previous - current) <= 64) {
+            ++near;
+        }
+        previous = current;
+    }
+    result.adjacent = container.size() > 1 ? static_cast<double>(near) / static_cast<double>(container.size() - 1) : 0;
+
+    perf_counter misses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    uint64_t sum = 0;
+    misses.start();
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t pass = 0; pass < s.passes; ++pass) {
+        for (const auto& value : container) {
+            if constexpr (requires { value.second; }) {
+                sum += value.second;
+            } else {
+                sum += value;
+            }
+        }
+    }
+    const auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    const auto missed = misses.stop();
+    const auto visits = static_cast<double>(container.size() * s.passes);
+    result.ns_per_node = ns / visits;
+    if (misses.valid()) {
+        result.misses_per_node = static_cast<double>(missed) / visits;
+    }
+    // keeps the traversal from being optimized out
+    keep_result(sum);
+    return result;
+}
+
+template<typename Allocator>
+locality run_list(Allocator alloc, const settings& s) {
+    using list = std::list<uint64_t, typename std::allocator_traits<Allocator>::template rebind_alloc<uint64_t>>;
+    list container(alloc);
+    std::mt19937_64 rng(42);
+    locality result;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<typename list::iterator> handles;
+    handles.reserve(s.nodes);
+    for (size_t i = 0; i < s.nodes; ++i) {
+        handles.push_back(container.insert(container.end(), i));
+    }
+    result.build_ms = elapsed_ms(start);
+
+    start = std::chrono::steady_clock::now();
+    const auto ops = static_cast<size_t>(s.churn * static_cast<double>(s.nodes));
+    for (size_t op = 0; op < ops; ++op) {
+        const auto victim = rng() % handles.size();
+        container.erase(handles[victim]);
+        const auto position = handles[rng() % handles.size()];
+        // position may be the erased node, insert at the end instead
+        handles[victim] = container.insert(position == handles[victim] ? container.end() : position, rng());
+    }
+    result.churn_ms = elapsed_ms(start);
+    return traverse(container, s, result);
+}
+
+template<typename Allocator>
+locality run_map(Allocator alloc, const settings& s) {
+    using value_alloc = typename std::allocator_traits<Allocator>::template rebind_alloc<std::pair<const uint64_t, uint64_t>>;
+    std::map<uint64_t, uint64_t, std::less<>, value_alloc> container(alloc);
+    std::mt19937_64 rng(42);
+    locality result;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint64_t> keys;
+    keys.reserve(s.nodes);
+    while (keys.size() < s.nodes) {
+        const auto key = rng();
+        if (container.emplace(key, key).second) {
+            keys.push_back(key);
+        }
+    }
+    result.build_ms = elapsed_ms(start);
+
+    start = std::chrono::steady_clock::now();
+    const auto ops = static_cast<size_t>(s.churn * static_cast<double>(s.nodes));
+    for (size_t op = 0; op < ops; ++op) {
+        const auto victim = rng() % keys.size();
+        container.erase(keys[victim]);
+        auto key = rng();
+        while (!container.emplace(key, key).second) {
+            key = rng();
+        }
+        keys[victim] = key;
+    }
+    result.churn_ms = elapsed_ms(start);
+    return traverse(container, s, result);
+}
+
+void print_row(const std::string& container, const std::string& allocator, const locality& l) {
+    std::cout << std::left << std::setw(8) << container << std::setw(40) << allocator << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << l.build_ms
+              << std::setw(12) << l.churn_ms
+              << std::setw(12) << l.ns_per_node;
+    if (l.misses_per_node < 0) {
+        std::cout << std::setw(14) << "n/a";
+    } else {
+        std::cout << std::setw(14) << l.misses_per_node;
+    }
+    std::cout << std::setw(12) << l.adjacent << "\n";
+}
+
+int main(int argc, char** argv) {
+    settings s;
+    std::vector<std::vector<pool_spec>> configs;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--nodes" && i + 1 < argc) {
+            s.nodes = std::stoull(argv[++i]);
+        } else if (arg == "--churn" && i + 1 < argc) {
+            s.churn = std::stod(argv[++i]);
+        } else if (arg == "--passes" && i + 1 < argc) {
+            s.passes = std::stoull(argv[++i]);
+        } else {
+            configs.push_back(parse_pool_config(arg));
+        }
+    }
+    if (configs.empty()) {
+        // list nodes take one 24 byte block, map nodes take two
+        for (auto policy : {bucket_policy::first_fit, bucket_policy::next_fit}) {
+            configs.push_back({{24, 3 * s.nodes, policy}});
+        }
+    }
+
+    std::cout << s.nodes << " nodes, churn " << s.churn << ", " << s.passes << " passes\n"
+              << std::left << std::setw(8) << "type" << std::setw(40) << "allocator" << std::right
+              << std::setw(12) << "build_ms"
+              << std::setw(12) << "churn_ms"
+              << std::setw(12) << "ns/node"
+              << std::setw(14) << "misses/node"
+              << std::setw(12) << "adjacent" << "\n";
+
+    print_row("list", "std::allocator", run_list(std::allocator<uint64_t>{}, s));
+    for (const auto& config : configs) {
+        with_pool(config, [&](auto& pool) {
+            MemoryPoolAllocator<uint64_t, std::tuple_size_v<std::remove_reference_t<decltype(pool)>>> alloc(pool);
+            print_row("list", "pool " + describe(config), run_list(alloc, s));
+        });
+    }
+    print_row("map", "std::allocator", run_map(std::allocator<uint64_t>{}, s));
+    for (const auto& config : configs) {
+        with_pool(config, [&](auto& pool) {
+            MemoryPoolAllocator<uint64_t, std::tuple_size_v<std::remove_reference_t<decltype(pool)>>> alloc(pool);
+            print_row("map", "pool " + describe(config), run_map(alloc, s));
+        });
+    }
+    return 0;
+}
@@ -1,17 +1,26 @@
 #include "../lib/MemoryPoolAllocator.h"
+#include "../lib/PoolVector.h"
 #include <iostream>
 #include <vector>
 #include <chrono>
 #include <list>
 #include <fstream>
 
-std::array<bucket, 2> buckets{bucket(8, 100000000), bucket(24, 100000000)};
+// committed on first use, zeroing 3.2 GB at static initialization took seconds
+std::array<bucket, 2> buckets{bucket(8, 100000000, bucket_policy::first_fit, {commit_mode::lazy}),
+                              bucket(24, 100000000, bucket_policy::first_fit, {commit_mode::lazy})};
+// pool_vector grows in place in the bucket until its run reaches the large
+// threshold, from then on it is a large region that mremap grows. So the
+// bucket only has to hold one run below the threshold
+std::array<bucket, 1> vector_buckets{bucket(8, default_large_threshold / 8, bucket_policy::first_fit, {commit_mode::lazy})};
 
 
 int main() {
     MemoryPoolAllocator<int, 2> alloc(buckets);
     std::vector<int, MemoryPoolAllocator<int, 2>> custom_vector(alloc);
     std::vector<int> standard_vector;
+    MemoryPoolAllocator<int, 1> vector_alloc(vector_buckets);
+    pool_vector<int, 1> growable_vector(vector_alloc);
     std::ofstream file("list_test.csv");
     for (int i = 1; i <= 100000000; i = i * 10) {
         // custom
@@ -31,7 +40,15 @@ int main() {
         }
         auto standard_stop = std::chrono::high_resolution_clock::now();
         auto standard_duration = duration_cast<std::chrono::microseconds>(standard_stop - standard_start);
-        file << standard_duration.count() << "\n";
+        file << standard_duration.count() << ",";
+        // pool_vector
+        auto growable_start = std::chrono::high_resolution_clock::now();
+        for (int _ = 0; _ < i; ++_) {
+            growable_vector.push_back(1);
+        }
+        auto growable_stop = std::chrono::high_resolution_clock::now();
+        auto growable_duration = duration_cast<std::chrono::microseconds>(growable_stop - growable_start);
+        file << growable_duration.count() << "\n";
     }
 
     return 0;
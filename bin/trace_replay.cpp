@@ -0,0 +1,105 @@
+#include "bench_common.h"
+#include <chrono>
+#include <iostream>
+#include <malloc.h>
+
+// Replays a recorded allocation trace against malloc or a pool layout
+//   trace_replay <trace> malloc
+//   trace_replay <trace> pool <block_size>:<block_count>...
+// Run one target per process, peak RSS is process wide
+
+struct replay_result {
+    std::chrono::microseconds duration{0};
+    size_t failed{0};
+    size_t peak_live_bytes{0};
+    size_t live_bytes{0};
+    size_t held_bytes{0};       // what the allocator holds for the live objects
+    double fragmentation{0};
+};
+
+// Allocate and Free are called as allocate(bytes) and free(ptr, bytes),
+// objects are written like a real service would
+template<typename Allocate, typename Free>
+replay_result replay(const std::vector<replay_op>& ops, size_t slot_count, Allocate&& allocate, Free&& free) {
+    replay_result result;
+    std::vector<void*> slots(slot_count, nullptr);
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& op : ops) {
+        if (op.allocate) {
+            void* ptr = allocate(op.size);
+            if (ptr == nullptr) {
+                ++result.failed;
+                continue;
+            }
+            std::memset(ptr, 0xAB, op.size);
+            slots[op.slot] = ptr;
+            result.live_bytes += op.size;
+            result.peak_live_bytes = std::max(result.peak_live_bytes, result.live_bytes);
+        } else if (slots[op.slot] != nullptr) {
+            free(slots[op.slot], op.size);
+            slots[op.slot] = nullptr;
+            result.live_bytes -= op.size;
+        }
+    }
+    result.duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+void report(const std::string& target, const replay_result& result) {
+    std::cout << "target:             " << target << "\n"
+              << "time_us:            " << result.duration.count() << "\n"
+              << "failed_allocations: " << result.failed << "\n"
+              << "peak_live_bytes:    " << result.peak_live_bytes << "\n"
+              << "live_bytes_at_end:  " << result.live_bytes << "\n"
+              << "held_bytes_at_end:  " << result.held_bytes << "\n"
+              << "fragmentation:      " << result.fragmentation << "\n"
+              << "peak_rss_kb:        " << peak_rss_kb() << "\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || (std::string(argv[2]) == "pool" && argc < 4)) {
+        std::cerr << "usage: " << argv[0] << " <trace> malloc\n"
+                  << "       " << argv[0] << " <trace> pool <block_size>:<block_count>...\n";
+        return 1;
+    }
+    size_t slot_count = 0;
+    const auto ops = prepare_replay(read_trace(argv[1]), slot_count);
+    const std::string target = argv[2];
+
+    if (target == "malloc") {
+        auto result = replay(ops, slot_count,
+                             [](size_t bytes) { return std::malloc(bytes); },
+                             [](void* ptr, size_t) { std::free(ptr); });
+        const auto heap = mallinfo2();
+        result.held_bytes = heap.uordblks + heap.hblkhd;
+        // free bytes inside the heap that are not returned to the OS
+        result.fragmentation = static_cast<double>(heap.fordblks) / static_cast<double>(heap.arena ? heap.arena : 1);
+        report(target, result);
+        return 0;
+    }
+    if (target != "pool") {
+        std::cerr << "unknown target " << target << "\n";
+        return 1;
+    }
+
+    std::vector<pool_spec> specs;
+    for (int i = 3; i < argc; ++i) {
+        specs.push_back(parse_pool_spec(argv[i]));
+    }
+    with_pool(specs, [&](auto& pool) {
+        MemoryPoolAllocator<uint8_t, std::tuple_size_v<std::remove_reference_t<decltype(pool)>>> alloc(pool);
+        auto result = replay(ops, slot_count,
+                             [&](size_t bytes) -> void* {
+                                 try {
+                                     return alloc.allocate(bytes);
+                                 } catch (const std::bad_alloc&) {
+                                     return nullptr;
+                                 }
+                             },
+                             [&](void* ptr, size_t bytes) { alloc.deallocate(static_cast<uint8_t*>(ptr), bytes); });
+        result.held_bytes = pool_used_bytes(pool);
+        result.fragmentation = pool_fragmentation(pool);
+        report("pool " + describe(specs), result);
+    });
+    return 0;
+}
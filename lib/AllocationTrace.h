@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Binary allocation trace: a header followed by fixed size records
+// in host byte order. Each allocate gets an object id, the matching
+// deallocate carries the same id, so a trace can be replayed without
+// knowing the addresses it was recorded with
+enum class trace_event_kind : uint8_t {
+    allocate = 0,
+    deallocate = 1,
+};
+
+struct trace_event {
+    uint64_t timestamp_ns{0};   // since the recorder was created
+    uint64_t object_id{0};
+    uint64_t size{0};           // bytes requested
+    uint16_t thread{0};         // recorder-assigned thread number
+    trace_event_kind kind{trace_event_kind::allocate};
+    uint8_t reserved[5]{};
+};
+static_assert(sizeof(trace_event) == 32, "trace records are 32 bytes on disk");
+
+struct trace_header {
+    char magic[4]{'M', 'P', 'A', 'T'};
+    uint32_t version{2};
+    uint64_t event_count{0};
+};
+
+inline void write_trace(const std::string& path, const std::vector<trace_event>& events) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("cannot open trace for writing: " + path);
+    }
+    trace_header header;
+    header.event_count = events.size();
+    const bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(events.data(), sizeof(trace_event), events.size(), file) == events.size();
+    std::fclose(file);
+    if (!ok) {
+        throw std::runtime_error("cannot write trace: " + path);
+    }
+}
+
+inline std::vector<trace_event> read_trace(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::runtime_error("cannot open trace: " + path);
+    }
+    trace_header header;
+    const trace_header expected;
+    if (std::fread(&header, sizeof(header), 1, file) != 1
+        || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+        || header.version != expected.version) {
+        std::fclose(file);
+        throw std::runtime_error("not an allocation trace: " + path);
+    }
+    std::vector<trace_event> events(header.event_count);
+    const auto read = std::fread(events.data(), sizeof(trace_event), events.size(), file);
+    std::fclose(file);
+    if (read != events.size()) {
+        throw std::runtime_error("truncated trace: " + path);
+    }
+    return events;
+}
+
+// Collects allocate/free events from every MemoryPoolAllocator while
+// installed with set_trace_recorder. Recording takes a lock, it is
+// meant for capturing traffic, not for running in the fast path forever.
+// At most max_live allocations are tracked at a time, the ones past that
+// are recorded without their free and counted by untracked()
+class trace_recorder {
+public:
+    explicit trace_recorder(size_t expected_events = 0, size_t max_live = size_t{1} << 22)
+        : start_(std::chrono::steady_clock::now())
+        , max_live_(max_live) {
+        events_.reserve(expected_events);
+    }
+
+    void record_allocate(const void* ptr, size_t bytes) {
+        std::lock_guard lock(mutex_);
+        const auto id = next_id_++;
+        // an address handed out again without a recorded free, such as
+        // after a reset of its bucket, ends the old allocation
+        if (const auto it = live_.find(ptr); it != live_.end()) {
+            push(trace_event_kind::deallocate, it->second.first, it->second.second);
+            it->second = {id, bytes};
+        } else if (live_.size() < max_live_) {
+            live_.emplace(ptr, std::make_pair(id, bytes));
+        } else {
+            ++untracked_;
+        }
+        push(trace_event_kind::allocate, id, bytes);
+    }
+
+    void record_deallocate(const void* ptr, size_t bytes) {
+        std::lock_guard lock(mutex_);
+        const auto it = live_.find(ptr);
+        // allocated before the recorder was installed, or not tracked
+        if (it == live_.end()) {
+            return;
+        }
+        const auto id = it->second.first;
+        live_.erase(it);
+        push(trace_event_kind::deallocate, id, bytes);
+    }
+
+    // every live allocation in [begin, end) is freed at once, as by a
+    // bucket reset after frees were ignored
+    void record_release(const void* begin, const void* end) {
+        std::lock_guard lock(mutex_);
+        for (auto it = live_.begin(); it != live_.end();) {
+            if (std::less_equal<const void*>{}(begin, it->first) && std::less<const void*>{}(it->first, end)) {
+                push(trace_event_kind::deallocate, it->second.first, it->second.second);
+                it = live_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // allocations recorded while max_live others were live, their frees are missing
+    size_t untracked() const {
+        std::lock_guard lock(mutex_);
+        return untracked_;
+    }
+
+    std::vector<trace_event> events() const {
+        std::lock_guard lock(mutex_);
+        return events_;
+    }
+
+    void save(const std::string& path) const {
+        write_trace(path, events());
+    }
+
+private:
+    void push(trace_event_kind kind, uint64_t id, size_t bytes) {
+        trace_event event;
+        event.timestamp_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+        event.object_id = id;
+        event.size = bytes;
+        event.thread = thread_number();
+        event.kind = kind;
+        events_.push_back(event);
+    }
+
+    uint16_t thread_number() {
+        const auto [it, inserted] = threads_.try_emplace(std::this_thread::get_id(),
+                                                         static_cast<uint16_t>(threads_.size()));
+        return it->second;
+    }
+
+    mutable std::mutex mutex_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t next_id_{0};
+    const size_t max_live_;
+    size_t untracked_{0};
+    // object id and bytes of every tracked live allocation
+    std::unordered_map<const void*, std::pair<uint64_t, size_t>> live_;
+    std::unordered_map<std::thread::id, uint16_t> threads_;
+    std::vector<trace_event> events_;
+};
+
+inline std::atomic<trace_recorder*> trace_recorder_hook{nullptr};
+
+// installs recorder for all allocators, nullptr stops recording
+// returns the previously installed recorder
+inline trace_recorder* set_trace_recorder(trace_recorder* recorder) {
+    return trace_recorder_hook.exchange(recorder);
+}
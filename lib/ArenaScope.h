@@ -0,0 +1,81 @@
+#pragma once
+
+#include <new>
+#include <stdexcept>
+
+#include "MemoryPoolAllocator.h"
+
+
+// Restores the bump pointer of an arena (a bucket with bucket_policy::bump)
+// when the scope ends, everything allocated inside is freed in O(1).
+// Scopes nest, containers using the arena must be destroyed first,
+// which is the case when they are declared after the scope
+class ArenaScope {
+public:
+    explicit ArenaScope(bucket& arena)
+        : arena_(arena)
+        , marker_(arena.mark()) {
+        if (arena.Policy != bucket_policy::bump) {
+            throw std::logic_error("ArenaScope needs a bucket with bucket_policy::bump");
+        }
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    ~ArenaScope() {
+        arena_.rewind(marker_);
+    }
+
+    bucket& arena() const {
+        return arena_;
+    }
+
+    // frees what was allocated in this scope so far, the scope stays open
+    void rewind() {
+        arena_.rewind(marker_);
+    }
+
+private:
+    bucket& arena_;
+    size_t marker_;
+};
+
+// Allocator for scratch containers inside an ArenaScope,
+// deallocate does nothing, memory comes back when the scope ends
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T                   value_type;
+    typedef value_type*         pointer;
+
+    template<typename U>
+    struct rebind{ using other = ArenaAllocator<U>; };
+
+    template<typename U>
+    friend class ArenaAllocator;
+
+    ArenaAllocator(bucket& arena) : arena_(&arena) {}
+
+    ArenaAllocator(const ArenaScope& scope) : arena_(&scope.arena()) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {}
+
+    pointer allocate(size_t n) {
+        if (auto ptr = arena_->allocate(n * sizeof(T)); ptr != nullptr) {
+            return static_cast<pointer>(ptr);
+        }
+        throw std::bad_alloc{};
+    }
+
+    void deallocate(pointer, size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena_ == other.arena_;
+    }
+
+private:
+    bucket* arena_;
+};
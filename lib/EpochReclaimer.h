@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "MemoryPoolAllocator.h"
+
+
+// Epoch based reclamation for lock-free structures over a pool. A thread
+// reads shared nodes only while pinned (epoch_participant::pin) and hands
+// nodes it unlinked to retire instead of freeing them. The global epoch
+// moves on once every pinned thread has seen it, so a node retired in
+// epoch e is unreachable by everyone once the epoch is e + 2; then it is
+// destroyed and its blocks go back to the buckets in a batch, taking the
+// pool lock once per batch instead of once per node.
+//
+// Every thread that touches the structure enrolls its own participant:
+//   epoch_domain<2> domain(alloc, pool_lock);
+//   epoch_participant<2> self(domain);
+//   { auto guard = self.pin(); ...read and unlink nodes...; self.retire(node); }
+template<size_t bucket_count>
+class epoch_domain {
+public:
+    // nodes are returned through alloc, under lock, batch retired nodes at a time
+    template<typename U, typename P>
+    epoch_domain(const MemoryPoolAllocator<U, bucket_count, P>& alloc, std::mutex& lock, size_t batch = 64)
+        : alloc_(alloc)
+        , lock_(lock)
+        , batch_(batch) {}
+
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+
+    // participants are gone by now, everything left over is unreachable
+    ~epoch_domain() {
+        reclaim(orphans_, UINT64_MAX);
+        auto record = records_.load(std::memory_order_acquire);
+        while (record != nullptr) {
+            delete std::exchange(record, record->next);
+        }
+    }
+
+    uint64_t epoch() const {
+        return epoch_.load(std::memory_order_acquire);
+    }
+
+private:
+    template<size_t>
+    friend class epoch_participant;
+
+    struct retired {
+        void* ptr;
+        size_t bytes;
+        uint64_t epoch;
+        void (*destroy)(void*, size_t);
+    };
+
+    // one per participant, reused after the participant leaves
+    struct record {
+        // (epoch << 1) | 1 while pinned, 0 otherwise
+        std::atomic<uint64_t> state{0};
+        std::atomic<bool> in_use{true};
+        record* next{nullptr};
+    };
+
+    record* enroll() {
+        for (auto r = records_.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            bool expected = false;
+            if (r->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                return r;
+            }
+        }
+        auto r = new record;
+        r->next = records_.load(std::memory_order_relaxed);
+        while (!records_.compare_exchange_weak(r->next, r, std::memory_order_acq_rel)) {}
+        return r;
+    }
+
+    void leave(record* r, std::vector<retired>& pending) {
+        r->state.store(0, std::memory_order_release);
+        r->in_use.store(false, std::memory_order_release);
+        if (!pending.empty()) {
+            std::lock_guard guard(lock_);
+            orphans_.insert(orphans_.end(), pending.begin(), pending.end());
+            has_orphans_.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // moves the epoch on when every pinned participant is in the current one
+    void try_advance() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto current = epoch_.load(std::memory_order_acquire);
+        for (auto r = records_.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+            const auto state = r->state.load(std::memory_order_acquire);
+            if ((state & 1) != 0 && (state >> 1) != current) {
+                return;
+            }
+        }
+        epoch_.compare_exchange_strong(current, current + 1, std::memory_order_acq_rel);
+    }
+
+    // hands the nodes left by participants that are gone to a live one
+    void adopt_orphans(std::vector<retired>& into) {
+        if (!has_orphans_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard guard(lock_);
+        into.insert(into.end(), orphans_.begin(), orphans_.end());
+        orphans_.clear();
+        has_orphans_.store(false, std::memory_order_relaxed);
+    }
+
+    // destroys and frees the nodes retired before the epoch safe,
+    // the others stay in list
+    void reclaim(std::vector<retired>& list, uint64_t safe) {
+        const auto split = std::partition(list.begin(), list.end(), [safe](const retired& r) {
+            return r.epoch >= safe;
+        });
+        if (split == list.end()) {
+            return;
+        }
+        for (auto it = split; it != list.end(); ++it) {
+            it->destroy(it->ptr, it->bytes);
+        }
+        // one deallocate_batch per size
+        std::sort(split, list.end(), [](const retired& lhs, const retired& rhs) {
+            return lhs.bytes < rhs.bytes;
+        });
+        std::vector<uint8_t*> ptrs;
+        std::lock_guard guard(lock_);
+        for (auto it = split; it != list.end();) {
+            const auto bytes = it->bytes;
+            ptrs.clear();
+            for (; it != list.end() && it->bytes == bytes; ++it) {
+                ptrs.push_back(static_cast<uint8_t*>(it->ptr));
+            }
+            alloc_.deallocate_batch(ptrs.data(), ptrs.size(), bytes);
+        }
+        list.erase(split, list.end());
+    }
+
+    MemoryPoolAllocator<uint8_t, bucket_count> alloc_;
+    std::mutex& lock_;
+    const size_t batch_;
+    std::atomic<uint64_t> epoch_{2};
+    std::atomic<record*> records_{nullptr};
+    // retired nodes of participants that left, guarded by lock_
+    std::vector<retired> orphans_;
+    std::atomic<bool> has_orphans_{false};
+};
+
+// A thread's membership in an epoch_domain, not shared between threads
+template<size_t bucket_count>
+class epoch_participant {
+public:
+    class guard {
+    public:
+        explicit guard(epoch_participant& self) : self_(&self) {
+            self.enter();
+        }
+
+        guard(guard&& other) noexcept : self_(std::exchange(other.self_, nullptr)) {}
+
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+
+        ~guard() {
+            if (self_ != nullptr) {
+                self_->exit();
+            }
+        }
+
+    private:
+        epoch_participant* self_;
+    };
+
+    explicit epoch_participant(epoch_domain<bucket_count>& domain)
+        : domain_(domain)
+        , record_(domain.enroll()) {}
+
+    epoch_participant(const epoch_participant&) = delete;
+    epoch_participant& operator=(const epoch_participant&) = delete;
+
+    // nodes not reclaimed yet are left to the domain
+    ~epoch_participant() {
+        domain_.leave(record_, retired_);
+    }
+
+    // shared nodes may be read while the guard lives, pins nest
+    guard pin() {
+        return guard(*this);
+    }
+
+    // ptr was unlinked by this thread and held n objects, it is destroyed
+    // and freed once no pinned thread can still see it
+    template<typename T>
+    void retire(T* ptr, size_t n = 1) {
+        retired_.push_back({ptr, n * sizeof(T), domain_.epoch(), [](void* p, size_t bytes) {
+            std::destroy_n(static_cast<T*>(p), bytes / sizeof(T));
+        }});
+        if (retired_.size() >= domain_.batch_) {
+            collect();
+        }
+    }
+
+    // tries to move the epoch on and frees what has become safe
+    void collect() {
+        domain_.adopt_orphans(retired_);
+        domain_.try_advance();
+        const auto epoch = domain_.epoch();
+        domain_.reclaim(retired_, epoch - 1);
+    }
+
+    size_t pending() const {
+        return retired_.size();
+    }
+
+private:
+    void enter() {
+        if (depth_++ == 0) {
+            // release, so whoever sees this pin also sees the reads of the
+            // sections before it, which the unpin alone does not give
+            record_->state.store((domain_.epoch() << 1) | 1, std::memory_order_release);
+            // the pin is visible before any shared node is read
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void exit() {
+        if (--depth_ == 0) {
+            record_->state.store(0, std::memory_order_release);
+        }
+    }
+
+    epoch_domain<bucket_count>& domain_;
+    typename epoch_domain<bucket_count>::record* record_;
+    std::vector<typename epoch_domain<bucket_count>::retired> retired_;
+    size_t depth_{0};
+};
@@ -1,10 +1,108 @@
 #pragma once
 
+#include <cerrno>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <array>
+#include <deque>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "AllocationTrace.h"
+
+
+// how a bucket looks for free blocks
+// first_fit: scan the ledger from the start, keeps blocks packed at the front
+// next_fit: resume after the last allocation, wraps around once
+// bump: arena, allocation moves a pointer along the data without ledger
+//       writes, deallocate does nothing and memory comes back only by reset
+enum class bucket_policy {
+    first_fit,
+    next_fit,
+    bump,
+};
+
+// Returning the pages of a bucket that became completely free to the OS.
+// A page is released once it stayed empty for decay_frees further frees
+// of the bucket, so a page that is emptied and refilled right away is not
+// released and faulted back in over and over. Released pages come back
+// transparently (zero filled) when a block on them is used again
+struct decommit_options {
+    size_t decay_frees{1024};
+    // MADV_FREE lets the kernel take the pages only under memory pressure
+    bool lazy{false};
+    // frees only queue empty pages, they are released by bucket::maintain
+    bool deferred{false};
+};
+
+// How the data of a bucket is committed when it is constructed
+// zero: memset by the constructing thread
+// lazy: a page is faulted in (zero filled) when a block on it is first used
+// populate: the kernel faults all pages in at once (MAP_POPULATE)
+// touch: several threads each write their share of the pages, every one
+//        pinned to its own cpu, so with first touch placement the pages
+//        of a NUMA machine are spread over the nodes of those cpus
+enum class commit_mode {
+    zero,
+    lazy,
+    populate,
+    touch,
+};
+
+struct commit_options {
+    commit_mode mode{commit_mode::zero};
+    // threads for commit_mode::touch, 0 takes one per usable cpu
+    size_t threads{0};
+    // mlock the data so it is never paged out, it is then committed
+    // whatever the mode is. Limited by RLIMIT_MEMLOCK
+    bool lock{false};
+};
+
+// First page of the file of a persistent bucket, followed by the ledger
+// and the data, both starting on a page boundary
+struct bucket_file_header {
+    char magic[4]{'M', 'P', 'B', 'F'};
+    uint32_t version{1};
+    uint64_t block_size{0};
+    uint64_t block_count{0};
+    uint32_t policy{0};
+    uint32_t reserved{0};
+    uint64_t ledger_offset{0};
+    uint64_t data_offset{0};
+    // bump pointer, written by sync and on destruction
+    uint64_t cursor{0};
+    // offset of the root object in the data + 1, 0 when there is none
+    uint64_t root{0};
+};
+
+// bytes of ledger for block_count blocks, one bit per block
+constexpr size_t bucket_ledger_size(size_t block_count) {
+    return 1 + ((block_count - 1) / 8);
+}
+
+// Storage for a bucket that is not allocated by the bucket, for static
+// (constinit) or stack pools. Static storage is zero pages until used
+template<size_t block_size, size_t block_count>
+struct bucket_storage {
+    alignas(std::max_align_t) uint8_t data[block_size * block_count];
+    uint8_t ledger[bucket_ledger_size(block_count)];
+};
 
 // A memory pool is split into buckets, each one
 // of which is split in chunks(blocks) of fixed size
@@ -14,20 +112,174 @@ class bucket {
 public:
     const size_t BlockSize;
     const size_t BlockCount;
-    bucket(size_t block_size, size_t block_count)
+    const bucket_policy Policy;
+    bucket(size_t block_size, size_t block_count, bucket_policy policy = bucket_policy::first_fit,
+           commit_options commit = {})
         : BlockSize(block_size)
-        , BlockCount(block_count) {
+        , BlockCount(block_count)
+        , Policy(policy) {
         const auto data_size = BlockCount * BlockSize;
-        data_ = static_cast<uint8_t*>(malloc(data_size));
-        const auto ledger_size = 1 + ((BlockCount - 1) / 8);
+        const auto populate = commit.mode == commit_mode::populate ? MAP_POPULATE : 0;
+        auto data = mmap(nullptr, data_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+        if (data == MAP_FAILED) {
+            throw std::bad_alloc{};
+        }
+        data_ = static_cast<uint8_t*>(data);
+        const auto ledger_size = bucket_ledger_size(BlockCount);
         ledger_ = static_cast<uint8_t*>(malloc(ledger_size));
-        std::memset(data_, 0, data_size);
+        if (ledger_ == nullptr) {
+            munmap(data_, data_size);
+            throw std::bad_alloc{};
+        }
         std::memset(ledger_, 0, ledger_size);
+        // the destructor does not run for a constructor that throws
+        try {
+            if (commit.mode == commit_mode::zero) {
+                std::memset(data_, 0, data_size);
+            } else if (commit.mode == commit_mode::touch) {
+                touch_pages(commit.threads);
+            }
+            if (commit.lock && mlock(data_, data_size) != 0) {
+                throw std::system_error(errno, std::generic_category(), "mlock of bucket data");
+            }
+        } catch (...) {
+            munmap(data_, data_size);
+            free(ledger_);
+            throw;
+        }
+    }
+
+    // Bucket over memory owned by the caller, such as a huge page region
+    // or a mapping made elsewhere: BlockSize * BlockCount bytes of data
+    // and bucket_ledger_size(BlockCount) bytes of ledger, which is cleared
+    // here. The data is not touched and both outlive the bucket
+    bucket(size_t block_size, size_t block_count, void* data, uint8_t* ledger,
+           bucket_policy policy = bucket_policy::first_fit)
+        : BlockSize(block_size)
+        , BlockCount(block_count)
+        , Policy(policy)
+        , data_(static_cast<uint8_t*>(data))
+        , ledger_(ledger)
+        , external_(true) {
+        std::memset(ledger_, 0, bucket_ledger_size(BlockCount));
+    }
+
+    template<size_t block_size, size_t block_count>
+    explicit bucket(bucket_storage<block_size, block_count>& storage, bucket_policy policy = bucket_policy::first_fit)
+        : bucket(block_size, block_count, storage.data, storage.ledger, policy) {}
+
+    // Persistent bucket: ledger and data live in the file at path, which
+    // is created when missing. An existing file is reopened with the
+    // blocks that were used when it was last closed, it must have been
+    // created with the same block size, count and policy or runtime_error
+    // is thrown. The file can be mapped at another address every time, so
+    // objects in it link to each other with offset_ptr and the entry point
+    // is kept with set_root. Only a system crash between sync calls can
+    // leave the ledger and the data of the file out of step
+    bucket(const std::string& path, size_t block_size, size_t block_count, bucket_policy policy = bucket_policy::first_fit)
+        : BlockSize(block_size)
+        , BlockCount(block_count)
+        , Policy(policy) {
+        const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const auto round_up = [page](size_t bytes) { return (bytes + page - 1) & ~(page - 1); };
+        bucket_file_header expected;
+        expected.block_size = BlockSize;
+        expected.block_count = BlockCount;
+        expected.policy = static_cast<uint32_t>(Policy);
+        expected.ledger_offset = round_up(sizeof(bucket_file_header));
+        expected.data_offset = expected.ledger_offset + round_up(bucket_ledger_size(BlockCount));
+        mapping_size_ = expected.data_offset + BlockSize * BlockCount;
+
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open bucket file " + path);
+        }
+        struct stat status {};
+        const bool created = fstat(fd, &status) == 0 && status.st_size == 0;
+        if (created && ftruncate(fd, static_cast<off_t>(mapping_size_)) != 0) {
+            close(fd);
+            throw std::runtime_error("cannot size bucket file " + path);
+        }
+        if (!created && static_cast<size_t>(status.st_size) != mapping_size_) {
+            close(fd);
+            throw std::runtime_error("bucket file " + path + " has another layout");
+        }
+        auto mapping = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("cannot map bucket file " + path);
+        }
+        mapping_ = static_cast<uint8_t*>(mapping);
+        auto header = file_header();
+        // a new file reads as zeros, the ledger is already clear
+        if (created) {
+            *header = expected;
+        } else if (std::memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0
+                   || header->version != expected.version
+                   || header->block_size != expected.block_size
+                   || header->block_count != expected.block_count
+                   || header->policy != expected.policy
+                   || header->ledger_offset != expected.ledger_offset
+                   || header->data_offset != expected.data_offset) {
+            munmap(mapping_, mapping_size_);
+            throw std::runtime_error("bucket file " + path + " has another layout");
+        }
+        ledger_ = mapping_ + header->ledger_offset;
+        data_ = mapping_ + header->data_offset;
+        cursor_ = header->cursor;
+        // the frontier and the free count below it follow from the ledger
+        if (Policy != bucket_policy::bump) {
+            for (size_t i = 0; i < BlockCount; ++i) {
+                if (is_used(i)) {
+                    recycled_free_ += i - frontier_;
+                    frontier_ = i + 1;
+                }
+            }
+        }
     }
 
     ~bucket() {
-        free(data_);
-        free(ledger_);
+        if (mapping_ != nullptr) {
+            file_header()->cursor = cursor_;
+            munmap(mapping_, mapping_size_);
+            return;
+        }
+        if (!external_) {
+            munmap(data_, BlockSize * BlockCount);
+            free(ledger_);
+        }
+    }
+
+    bool persistent() const {
+        return mapping_ != nullptr;
+    }
+
+    // writes the ledger and the data of a persistent bucket to its file
+    void sync() {
+        if (mapping_ != nullptr) {
+            file_header()->cursor = cursor_;
+            msync(mapping_, mapping_size_, MS_SYNC);
+        }
+    }
+
+    // the object a reopened persistent bucket is entered from,
+    // nullptr when none was set
+    void* root() const {
+        if (mapping_ == nullptr || file_header()->root == 0) {
+            return nullptr;
+        }
+        return data_ + (file_header()->root - 1);
+    }
+
+    void set_root(void* ptr) {
+        if (mapping_ != nullptr) {
+            file_header()->root = ptr == nullptr ? 0 : static_cast<size_t>(static_cast<uint8_t*>(ptr) - data_) + 1;
+        }
+    }
+
+    // first byte of the first block
+    uint8_t* data() const {
+        return data_;
     }
 
     bool belongs(void* ptr) const {
@@ -36,50 +288,607 @@ public:
 
     void* allocate(size_t bytes) {
         // how many blocks we need
-        const auto n = 1 + ((bytes - 1) / BlockSize);
-        const auto index = find_contiguous_blocks(n);
+        const auto n = blocks_for(bytes);
+        if (Policy == bucket_policy::bump) {
+            if (n > BlockCount - cursor_) {
+                return nullptr;
+            }
+            const auto ptr = data_ + (cursor_ * BlockSize);
+            cursor_ += n;
+            return ptr;
+        }
+        const auto fits_past_frontier = n <= BlockCount - frontier_;
+        auto index = BlockCount;
+        // the recycled region below the frontier is only searched when it has enough free blocks
+        if (Policy == bucket_policy::next_fit) {
+            // from the cursor to the end, the region past the frontier included, then wrap
+            const auto start = std::min(cursor_, frontier_);
+            if (recycled_free_ >= n) {
+                index = find_contiguous_blocks(n, start, frontier_);
+            }
+            if (index == BlockCount && !fits_past_frontier && recycled_free_ >= n) {
+                index = find_contiguous_blocks(n, 0, std::min(start + n - 1, frontier_));
+            }
+        } else if (recycled_free_ >= n && n < run_limit_) {
+            index = take_from_summary(n);
+            if (index == BlockCount) {
+                index = scan_first_fit(n);
+            }
+        }
         if (index == BlockCount) {
-            return nullptr;
+            if (!fits_past_frontier) {
+                return nullptr;
+            }
+            index = frontier_;
         }
-        set_used(index, n);
+        take(index, n);
+        cursor_ = index + n;
         return data_ + (index * BlockSize);
     }
 
     void deallocate(void* ptr, size_t bytes) {
+        if (ignore_frees_ || Policy == bucket_policy::bump) {
+            return;
+        }
         const auto p = static_cast<uint8_t*>(ptr);
         const auto distance = static_cast<size_t>(p - data_);
         // find block #
         const auto index = distance / BlockSize;
         // how many blocks to free
-        const auto n = 1 + ((bytes - 1) / BlockSize);
-        set_free(index, n);
+        const auto n = blocks_for(bytes);
+        release(index, n);
+    }
+
+    // claims up to count runs for bytes each in a single pass over the ledger
+    // returns how many pointers were written to out
+    size_t allocate_batch(size_t bytes, size_t count, void** out) {
+        const auto n = blocks_for(bytes);
+        if (Policy == bucket_policy::bump) {
+            const auto claimed = std::min(count, (BlockCount - cursor_) / n);
+            for (size_t i = 0; i < claimed; ++i) {
+                out[i] = data_ + ((cursor_ + i * n) * BlockSize);
+            }
+            cursor_ += claimed * n;
+            return claimed;
+        }
+        size_t claimed = 0;
+        const auto claim = [&](size_t first, size_t last) {
+            size_t run = 0;
+            for (size_t i = first; i < last && claimed < count && recycled_free_ >= n; ++i) {
+                if (is_used(i)) {
+                    run = 0;
+                } else if (++run == n) {
+                    const auto index = i + 1 - n;
+                    take(index, n);
+                    out[claimed++] = data_ + (index * BlockSize);
+                    cursor_ = i + 1;
+                    run = 0;
+                }
+            }
+        };
+        const auto bump = [&] {
+            while (claimed < count && n <= BlockCount - frontier_) {
+                const auto index = frontier_;
+                take(index, n);
+                out[claimed++] = data_ + (index * BlockSize);
+                cursor_ = index + n;
+            }
+        };
+        if (Policy == bucket_policy::next_fit) {
+            const auto start = std::min(cursor_, frontier_);
+            claim(start, frontier_);
+            bump();
+            claim(0, std::min(start + n - 1, frontier_));
+        } else {
+            if (n < run_limit_) {
+                claim(first_free_, frontier_);
+            }
+            // the rest comes from the never used blocks past the frontier
+            bump();
+        }
+        return claimed;
+    }
+
+    void deallocate_batch(void* const* ptrs, size_t count, size_t bytes) {
+        if (ignore_frees_ || Policy == bucket_policy::bump) {
+            return;
+        }
+        const auto n = blocks_for(bytes);
+        for (size_t i = 0; i < count; ++i) {
+            const auto distance = static_cast<size_t>(static_cast<uint8_t*>(ptrs[i]) - data_);
+            release(distance / BlockSize, n);
+        }
+    }
+
+    // takes back the runs the last allocate_batch wrote to ptrs, also
+    // while frees are ignored; a bump bucket moves its pointer back
+    void undo_batch(void* const* ptrs, size_t count, size_t bytes) {
+        const auto n = blocks_for(bytes);
+        for (size_t i = count; i-- > 0;) {
+            const auto index = index_of(ptrs[i]);
+            if (Policy != bucket_policy::bump) {
+                release(index, n);
+            } else if (index + n == cursor_) {
+                cursor_ = index;
+            }
+        }
+    }
+
+    // bytes actually reserved for a request of bytes
+    size_t capacity_for(size_t bytes) const {
+        return blocks_for(bytes) * BlockSize;
+    }
+
+    // grows the run at ptr in place when the blocks following it are free
+    // (or never used), returns false and changes nothing otherwise
+    bool try_expand(void* ptr, size_t old_bytes, size_t new_bytes) {
+        const auto index = static_cast<size_t>(static_cast<uint8_t*>(ptr) - data_) / BlockSize;
+        const auto old_n = blocks_for(old_bytes);
+        const auto new_n = blocks_for(new_bytes);
+        if (new_n <= old_n) {
+            return true;
+        }
+        const auto end = index + old_n;
+        const auto new_end = index + new_n;
+        if (new_end > BlockCount) {
+            return false;
+        }
+        if (Policy == bucket_policy::bump) {
+            // only the last allocation can grow
+            if (end != cursor_) {
+                return false;
+            }
+            cursor_ = new_end;
+            return true;
+        }
+        for (auto i = end; i < std::min(new_end, frontier_); ++i) {
+            if (is_used(i)) {
+                return false;
+            }
+        }
+        if (end < frontier_) {
+            take(end, std::min(new_end, frontier_) - end);
+        }
+        if (new_end > frontier_) {
+            take(frontier_, new_end - frontier_);
+        }
+        return true;
+    }
+
+    // gives the tail of the run at ptr back, returns false when nothing
+    // could be freed (a bump allocation that is not the last one)
+    bool try_shrink(void* ptr, size_t old_bytes, size_t new_bytes) {
+        const auto index = static_cast<size_t>(static_cast<uint8_t*>(ptr) - data_) / BlockSize;
+        const auto old_n = blocks_for(old_bytes);
+        const auto new_n = blocks_for(new_bytes);
+        if (new_n >= old_n) {
+            return new_n == old_n;
+        }
+        if (Policy == bucket_policy::bump) {
+            if (index + old_n != cursor_) {
+                return false;
+            }
+            cursor_ = index + new_n;
+            return true;
+        }
+        if (!ignore_frees_) {
+            release(index + new_n, old_n - new_n);
+        }
+        return true;
+    }
+
+    // position of the bump pointer, for bump buckets only
+    size_t mark() const {
+        return cursor_;
+    }
+
+    // frees everything allocated after marker was taken with mark()
+    // markers past the current position are ignored
+    void rewind(size_t marker) {
+        if (Policy == bucket_policy::bump && marker <= cursor_) {
+            cursor_ = marker;
+        }
+    }
+
+    // marks every block free without touching the data, outstanding
+    // pointers become invalid. release_pages also gives the data pages
+    // back to the OS, they read as zero when touched again. The data of
+    // persistent buckets and of buckets over caller-owned memory is not
+    // the bucket's to release and stays as it is
+    void reset(bool release_pages = false) {
+        // the ledger is clear past the frontier and bump buckets never write it
+        if (Policy != bucket_policy::bump && frontier_ > 0) {
+            std::memset(ledger_, 0, 1 + ((frontier_ - 1) / 8));
+        }
+        cursor_ = 0;
+        frontier_ = 0;
+        recycled_free_ = 0;
+        first_free_ = 0;
+        run_limit_ = SIZE_MAX;
+        ignore_frees_ = false;
+        free_runs_.clear();
+        scanned_runs_.clear();
+        scan_at_ = 0;
+        scan_run_ = 0;
+        if (decommit_enabled_) {
+            std::fill(page_users_.begin(), page_users_.end(), 0);
+            std::fill(page_empty_since_.begin(), page_empty_since_.end(), 0);
+            empty_pages_.clear();
+        }
+        if (release_pages && mapping_ == nullptr && !external_) {
+            const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+            const auto begin = (reinterpret_cast<uintptr_t>(data_) + page - 1) & ~(page - 1);
+            const auto end = (reinterpret_cast<uintptr_t>(data_) + BlockSize * BlockCount) & ~(page - 1);
+            if (begin < end) {
+                madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+            }
+        }
+    }
+
+    // starts tracking how many used blocks lie on every page of the data,
+    // for first_fit and next_fit buckets that own their data anonymously
+    void enable_decommit(decommit_options options = {}) {
+        if (Policy == bucket_policy::bump || mapping_ != nullptr || external_) {
+            return;
+        }
+        decommit_ = options;
+        page_size_ = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        page_base_ = reinterpret_cast<uintptr_t>(data_) & ~(page_size_ - 1);
+        const auto pages = (reinterpret_cast<uintptr_t>(data_) + BlockSize * BlockCount - page_base_ + page_size_ - 1) / page_size_;
+        page_users_.assign(pages, 0);
+        page_empty_since_.assign(pages, 0);
+        page_decommitted_.assign(pages, false);
+        for (size_t i = 0; i < frontier_; ++i) {
+            if (is_used(i)) {
+                track_pages(i, 1, true);
+            }
+        }
+        decommit_enabled_ = true;
+    }
+
+    // deferred bookkeeping, meant to run off the hot path (idle time or
+    // pool_maintainer): releases the pages whose decay has passed or that
+    // were empty already at the previous pass, and
+    // rebuilds the summary of free runs below the frontier, which
+    // first_fit allocation uses before it scans the ledger.
+    // A call looks at no more than budget blocks of the ledger, so with a
+    // budget the caller holds its lock for a bounded time; the scan
+    // resumes where the previous call stopped and true is returned once
+    // the pass is complete and the new summary is in use. A budget of 0
+    // would make no progress and throws invalid_argument
+    bool maintain(size_t budget = SIZE_MAX) {
+        if (budget == 0) {
+            throw std::invalid_argument("bucket::maintain needs a budget of at least one block");
+        }
+        if (Policy == bucket_policy::bump) {
+            return true;
+        }
+        if (scan_at_ == 0 && decommit_enabled_) {
+            // a page that stayed empty since the previous pass is idle
+            // even when there were fewer than decay_frees frees
+            decay(maintained_at_);
+            maintained_at_ = frees_;
+        }
+        // the frontier may have moved back below the scan since the last call
+        const auto end = budget < frontier_ - std::min(scan_at_, frontier_) ? scan_at_ + budget : frontier_;
+        for (auto i = scan_at_; i < end; ++i) {
+            if (!is_used(i)) {
+                ++scan_run_;
+            } else if (scan_run_ > 0) {
+                scanned_runs_.emplace_back(i - scan_run_, scan_run_);
+                scan_run_ = 0;
+            }
+        }
+        if (end < frontier_) {
+            scan_at_ = end;
+            return false;
+        }
+        // lowest address at the back
+        std::reverse(scanned_runs_.begin(), scanned_runs_.end());
+        free_runs_.swap(scanned_runs_);
+        scanned_runs_.clear();
+        scan_at_ = 0;
+        scan_run_ = 0;
+        return true;
+    }
+
+    size_t decommitted_pages() const {
+        return decommitted_count_;
+    }
+
+    // while set deallocate does nothing, so a container can be destroyed
+    // without freeing its nodes one by one before the bucket is reset
+    void ignore_frees(bool ignore) {
+        ignore_frees_ = ignore;
+    }
+
+    bool frees_ignored() const {
+        return ignore_frees_;
+    }
+
+    size_t free_blocks() const {
+        if (Policy == bucket_policy::bump) {
+            return BlockCount - cursor_;
+        }
+        return recycled_free_ + (BlockCount - frontier_);
+    }
+
+    size_t largest_free_run() const {
+        if (Policy == bucket_policy::bump) {
+            return BlockCount - cursor_;
+        }
+        size_t best = BlockCount - frontier_;
+        size_t run = 0;
+        for (size_t i = 0; i < frontier_; ++i) {
+            run = is_used(i) ? 0 : run + 1;
+            best = std::max(best, run);
+        }
+        return best;
+    }
+
+    // Blocks by index, for structures that choose their blocks themselves
+    // (slot_map) in first_fit and next_fit buckets
+
+    void* block(size_t index) const {
+        return data_ + (index * BlockSize);
+    }
+
+    size_t index_of(const void* ptr) const {
+        return static_cast<size_t>(static_cast<const uint8_t*>(ptr) - data_) / BlockSize;
+    }
+
+    bool is_used(size_t index) const {
+        return ledger_[index / 8] & (1 << (7 - index % 8));
+    }
+
+    // marks the block at index used, false when it is used already
+    bool claim(size_t index) {
+        if (index >= BlockCount || is_used(index)) {
+            return false;
+        }
+        // blocks skipped over stay free below the new frontier
+        if (index > frontier_) {
+            recycled_free_ += index - frontier_;
+            if (index - frontier_ >= run_limit_) {
+                run_limit_ = SIZE_MAX;
+            }
+        }
+        take(index, 1);
+        return true;
     }
 
 private:
-    // returns BlockCount when there are no such blocks
-    size_t find_contiguous_blocks(size_t n) const {
-        size_t count = 0;
-        size_t shift = 0;
-        size_t begin_index = 0;
-        bool found = false;
-        const auto ledger_size = 1 + ((BlockCount - 1) / 8);
-        for (int i = 0; i < ledger_size; ++i) {
-            uint8_t cur = ledger_[i];
-            for (int j = 7; j>= 0; --j) {
-                if (!(cur & (1 << j))) {
-                    count++;
-                    if (count == n) {
-                        found = true;
-                        break;
+    // gives the ledger microbenchmarks access to the private ledger operations
+    friend struct ledger_access;
+
+    bucket_file_header* file_header() const {
+        return reinterpret_cast<bucket_file_header*>(mapping_);
+    }
+
+    // commit_mode::touch, thread i writes one byte of every page in its
+    // slice of the data while pinned to the i-th usable cpu
+    void touch_pages(size_t threads) {
+        cpu_set_t usable;
+        CPU_ZERO(&usable);
+        std::vector<int> cpus;
+        if (sched_getaffinity(0, sizeof(usable), &usable) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &usable)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        if (threads == 0) {
+            threads = std::max<size_t>(cpus.size(), 1);
+        }
+        const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const auto pages = (BlockSize * BlockCount + page - 1) / page;
+        threads = std::min(threads, pages);
+        std::vector<std::thread> touching;
+        try {
+            for (size_t t = 0; t < threads; ++t) {
+                touching.emplace_back([this, t, threads, page, pages, &cpus] {
+                    if (!cpus.empty()) {
+                        cpu_set_t own;
+                        CPU_ZERO(&own);
+                        CPU_SET(cpus[t % cpus.size()], &own);
+                        pthread_setaffinity_np(pthread_self(), sizeof(own), &own);
+                    }
+                    auto volatile* data = data_;
+                    for (auto p = pages * t / threads; p < pages * (t + 1) / threads; ++p) {
+                        data[p * page] = 0;
                     }
-                } else {
-                    count = 0;
-                    begin_index = i;
-                    shift = (8 - j) % 8;
+                });
+            }
+        } catch (...) {
+            // threads that did start still touch the data, which goes away after the throw
+            for (auto& thread : touching) {
+                thread.join();
+            }
+            throw;
+        }
+        for (auto& thread : touching) {
+            thread.join();
+        }
+    }
+
+    // zero sized requests still take a block so the pointer is unique
+    size_t blocks_for(size_t bytes) const {
+        return bytes == 0 ? 1 : 1 + ((bytes - 1) / BlockSize);
+    }
+
+    // marks a run used, index is either below the frontier or at it
+    void take(size_t index, size_t n) {
+        set_used(index, n);
+        if (index == first_free_) {
+            first_free_ = index + n;
+        }
+        if (index < frontier_) {
+            recycled_free_ -= n;
+        } else {
+            frontier_ = index + n;
+        }
+        if (recycled_free_ == 0) {
+            first_free_ = frontier_;
+        }
+        if (decommit_enabled_) {
+            track_pages(index, n, true);
+        }
+    }
+
+    // a run freed right below the frontier moves the frontier back over
+    // it and over any free blocks before it, so no free run straddles it
+    void release(size_t index, size_t n) {
+        set_free(index, n);
+        first_free_ = std::min(first_free_, index);
+        if (decommit_enabled_) {
+            track_pages(index, n, false);
+            ++frees_;
+            if (!decommit_.deferred) {
+                decay();
+            }
+        }
+        if (index + n != frontier_) {
+            recycled_free_ += n;
+            if (run_limit_ == SIZE_MAX) {
+                return;
+            }
+            // the run joins the free blocks around it, the limit holds as
+            // long as the joined run stays shorter
+            auto length = n;
+            for (auto i = index; i > 0 && length < run_limit_ && !is_used(i - 1); --i) {
+                ++length;
+            }
+            for (auto i = index + n; i < frontier_ && length < run_limit_ && !is_used(i); ++i) {
+                ++length;
+            }
+            if (length >= run_limit_) {
+                run_limit_ = SIZE_MAX;
+            }
+            return;
+        }
+        frontier_ = index;
+        while (frontier_ > 0 && !is_used(frontier_ - 1)) {
+            --frontier_;
+            --recycled_free_;
+        }
+    }
+
+    // counts the blocks of the run on (used) or off every page they touch,
+    // a block that straddles two pages counts on both. Pages that become
+    // empty start their decay
+    void track_pages(size_t index, size_t n, bool used) {
+        const auto offset = reinterpret_cast<uintptr_t>(data_) - page_base_;
+        const auto first_page = (offset + index * BlockSize) / page_size_;
+        const auto last_page = (offset + (index + n) * BlockSize - 1) / page_size_;
+        for (auto page = first_page; page <= last_page; ++page) {
+            const auto page_begin = page * page_size_;
+            const auto first = std::max(index, page_begin > offset ? (page_begin - offset) / BlockSize : 0);
+            const auto last = std::min(index + n, (page_begin + page_size_ - offset + BlockSize - 1) / BlockSize);
+            const auto blocks = static_cast<uint32_t>(last - first);
+            if (used) {
+                if (page_users_[page] == 0) {
+                    page_empty_since_[page] = 0;
+                    if (page_decommitted_[page]) {
+                        page_decommitted_[page] = false;
+                        --decommitted_count_;
+                    }
+                }
+                page_users_[page] += blocks;
+            } else if ((page_users_[page] -= blocks) == 0) {
+                // stored + 1 so that 0 means not empty
+                page_empty_since_[page] = frees_ + 1;
+                empty_pages_.emplace_back(page, frees_);
+            }
+        }
+    }
+
+    // releases the pages that have been empty for decay_frees frees
+    // and those that became empty before the free count older_than
+    void decay(uint64_t older_than = 0) {
+        while (!empty_pages_.empty()
+               && (empty_pages_.front().second + decommit_.decay_frees <= frees_ || empty_pages_.front().second < older_than)) {
+            const auto [page, since] = empty_pages_.front();
+            empty_pages_.pop_front();
+            // refilled (and maybe emptied again) since it was queued
+            if (page_empty_since_[page] != since + 1 || page_decommitted_[page]) {
+                continue;
+            }
+            const auto address = page_base_ + page * page_size_;
+            // the first and last page may be shared with other allocations
+            if (address < reinterpret_cast<uintptr_t>(data_)
+                || address + page_size_ > reinterpret_cast<uintptr_t>(data_ + BlockSize * BlockCount)) {
+                continue;
+            }
+            madvise(reinterpret_cast<void*>(address), page_size_, decommit_.lazy ? MADV_FREE : MADV_DONTNEED);
+            page_decommitted_[page] = true;
+            ++decommitted_count_;
+        }
+    }
+
+    // lowest free run from the maintain() summary that still holds n blocks,
+    // runs that are too short are passed over and kept for smaller requests.
+    // BlockCount when the summary has none. Blocks may have been taken
+    // and the frontier moved since the summary was built, so the run is
+    // checked before use
+    size_t take_from_summary(size_t n) {
+        for (auto i = free_runs_.size(); i-- > 0;) {
+            auto& [start, length] = free_runs_[i];
+            if (length < n) {
+                continue;
+            }
+            const auto index = start;
+            start += n;
+            length -= n;
+            if (length == 0) {
+                free_runs_.erase(free_runs_.begin() + static_cast<std::ptrdiff_t>(i));
+            }
+            // the frontier may have moved back below the run
+            if (index + n <= frontier_ && find_contiguous_blocks(n, index, index + n) == index) {
+                return index;
+            }
+        }
+        return BlockCount;
+    }
+
+    // lowest run of n free blocks below the frontier, from the first free
+    // block on and over full ledger bytes a byte at a time. When there is
+    // none the longest run seen bounds the requests that scan again
+    size_t scan_first_fit(size_t n) {
+        size_t count = 0;
+        size_t longest = 0;
+        bool seen_free = false;
+        for (auto i = first_free_; i < frontier_; ++i) {
+            if (i % 8 == 0 && ledger_[i / 8] == 0xFF) {
+                longest = std::max(longest, count);
+                count = 0;
+                i += 7;
+            } else if (is_used(i)) {
+                longest = std::max(longest, count);
+                count = 0;
+            } else {
+                if (!seen_free) {
+                    first_free_ = i;
+                    seen_free = true;
+                }
+                if (++count == n) {
+                    return i + 1 - n;
                 }
             }
-            if (found) {
-                return 8 * begin_index + shift;
+        }
+        run_limit_ = std::max(longest, count) + 1;
+        return BlockCount;
+    }
+
+    // looks for n free blocks in [first, last)
+    // returns BlockCount when there are no such blocks
+    size_t find_contiguous_blocks(size_t n, size_t first, size_t last) const {
+        size_t count = 0;
+        for (size_t i = first; i < last; ++i) {
+            if (is_used(i)) {
+                count = 0;
+            } else if (++count == n) {
+                return i + 1 - n;
             }
         }
         return BlockCount;
@@ -137,6 +946,50 @@ private:
 
     uint8_t* data_;
     uint8_t* ledger_;
+    // the whole file of a persistent bucket, nullptr otherwise
+    uint8_t* mapping_{nullptr};
+    size_t mapping_size_{0};
+    // data and ledger belong to the caller
+    bool external_{false};
+    // first block after the last allocation, used by next_fit
+    // and as the bump pointer of bump buckets
+    size_t cursor_{0};
+    // blocks from the frontier on have never been used since the last
+    // reset, they are allocated without searching the ledger
+    size_t frontier_{0};
+    // free blocks below the frontier
+    size_t recycled_free_{0};
+    // every block below it is used, first_fit scans start there
+    size_t first_free_{0};
+    // every free run below the frontier is shorter than this, SIZE_MAX
+    // while that is not known. Set by a first_fit scan that found no run
+    size_t run_limit_{SIZE_MAX};
+    bool ignore_frees_{false};
+
+    // page tracking for enable_decommit
+    bool decommit_enabled_{false};
+    decommit_options decommit_;
+    size_t page_size_{0};
+    uintptr_t page_base_{0};
+    // used blocks on every page
+    std::vector<uint32_t> page_users_;
+    // frees_ + 1 when the page became empty, 0 while it is used
+    std::vector<uint64_t> page_empty_since_;
+    std::vector<bool> page_decommitted_;
+    // pages in the order they became empty, with frees_ at that time
+    std::deque<std::pair<size_t, uint64_t>> empty_pages_;
+    uint64_t frees_{0};
+    // frees_ at the start of the previous maintain() pass
+    uint64_t maintained_at_{0};
+    size_t decommitted_count_{0};
+    // free runs (first block, length) below the frontier as of the last
+    // maintain(), lowest address last
+    std::vector<std::pair<size_t, size_t>> free_runs_;
+    // the maintain() pass in progress: next block to look at, length of
+    // the free run it is in and the runs found so far, lowest first
+    size_t scan_at_{0};
+    size_t scan_run_{0};
+    std::vector<std::pair<size_t, size_t>> scanned_runs_;
 };
 
 // used to determine from which bucket to allocate memory
@@ -149,21 +1002,86 @@ struct info {
     bool operator<(const info& other) const {
         return (waste == other.waste) ? block_count < other.block_count : waste < other.waste;
     }
+
+    // cost of serving bytes from the bucket #index with blocks of block_size
+    static info rank(size_t index, size_t block_size, size_t bytes) {
+        info option;
+        option.index = index;
+        if (block_size >= bytes) {
+            option.waste = block_size - bytes;
+            option.block_count = 1;
+        } else {
+            const auto n = 1 + ((bytes - 1) / block_size);
+            const auto mem_required = n * block_size;
+            option.waste = mem_required - bytes;
+            option.block_count = n;
+        }
+        return option;
+    }
+};
+
+// Requests of at least the large threshold bypass the buckets, each one gets
+// its own anonymous mapping and growing it moves pages with mremap instead
+// of copying bytes. Pools with a persistent bucket have no large threshold
+constexpr size_t default_large_threshold = size_t{1} << 20;
+
+struct large_region {
+    static size_t capacity_for(size_t bytes) {
+        const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return (bytes + page - 1) & ~(page - 1);
+    }
+
+    // nullptr when the mapping fails
+    static void* allocate(size_t bytes) {
+        void* ptr = mmap(nullptr, capacity_for(bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    static void deallocate(void* ptr, size_t bytes) {
+        munmap(ptr, capacity_for(bytes));
+    }
+
+    // stays in place unless may_move, nullptr when that is not possible
+    static void* resize(void* ptr, size_t old_bytes, size_t new_bytes, bool may_move) {
+        void* moved = mremap(ptr, capacity_for(old_bytes), capacity_for(new_bytes), may_move ? MREMAP_MAYMOVE : 0);
+        return moved == MAP_FAILED ? nullptr : moved;
+    }
 };
 
-template<typename T, size_t bucket_count>
+// result of MemoryPoolAllocator::allocate_at_least, mirrors std::allocation_result
+template<typename Pointer>
+struct pool_allocation {
+    Pointer ptr;
+    size_t count;
+};
+
+// Pointer is the pointer type handed out to containers, a fancy pointer
+// such as offset_ptr<T> (OffsetPtr.h) for containers that are kept in a
+// persistent bucket. It has to be constructible from T*, the allocator
+// works with std::to_address of it
+template<typename T, size_t bucket_count, typename Pointer = T*>
 class MemoryPoolAllocator {
 public:
     typedef T                   value_type;
-    typedef value_type*         pointer;
+    typedef Pointer             pointer;
 
     template<typename U>
-    struct rebind{ using other = MemoryPoolAllocator<U, bucket_count>; };
+    struct rebind{ using other = MemoryPoolAllocator<U, bucket_count, typename std::pointer_traits<Pointer>::template rebind<U>>; };
 
-    MemoryPoolAllocator(std::array<bucket, bucket_count>& pool) : pool_(pool) {};
+    template<typename U, size_t, typename>
+    friend class MemoryPoolAllocator;
 
-    template<typename U>
-    MemoryPoolAllocator(const MemoryPoolAllocator<U, bucket_count>& other) : pool_(other.pool_) {}
+    // requests of large_threshold bytes or more are served by large_region,
+    // unless a bucket of the pool is persistent: an anonymous region would
+    // not be in the file, so every request is served by the buckets then
+    MemoryPoolAllocator(std::array<bucket, bucket_count>& pool, size_t large_threshold = default_large_threshold)
+        : pool_(pool)
+        , large_threshold_(has_persistent(pool) ? SIZE_MAX : large_threshold) {};
+
+    template<typename U, typename P>
+    MemoryPoolAllocator(const MemoryPoolAllocator<U, bucket_count, P>& other)
+        : pool_(other.pool_)
+        , large_threshold_(other.large_threshold_) {}
 
     template<typename U>
     MemoryPoolAllocator& operator+(const MemoryPoolAllocator& other) {
@@ -171,42 +1089,324 @@ public:
         return *this;
     }
 
-    pointer allocate(size_t bytes) {
+    // n is the number of objects, as with std::allocator
+    pointer allocate(size_t n) {
+        const auto bytes = n * sizeof(T);
+        return make_pointer(allocate_bytes(bytes).first, bytes);
+    }
+
+    // like allocate, count tells how many objects fit into the blocks taken
+    pool_allocation<pointer> allocate_at_least(size_t n) {
+        const auto bytes = n * sizeof(T);
+        const auto [ptr, owner] = allocate_bytes(bytes);
+        // a bucket run reported as large would be unmapped on deallocate
+        const auto capacity = owner != nullptr ? std::min(owner->capacity_for(bytes), large_threshold_ - 1)
+                                               : large_region::capacity_for(bytes);
+        return {make_pointer(ptr, bytes), capacity / sizeof(T)};
+    }
+
+    // grows the allocation at ptr from old_n to new_n objects without moving it
+    // returns false when the blocks (or pages) after it are taken.
+    // An allocation never crosses the large threshold in place
+    bool expand(pointer ptr, size_t old_n, size_t new_n) {
+        const auto old_bytes = old_n * sizeof(T);
+        const auto new_bytes = new_n * sizeof(T);
+        const auto raw = std::to_address(ptr);
+        bool expanded = false;
+        if (old_bytes >= large_threshold_) {
+            expanded = large_region::resize(raw, old_bytes, new_bytes, false) != nullptr;
+        } else if (new_bytes < large_threshold_) {
+            auto owner = owner_of(raw);
+            expanded = owner != nullptr && owner->try_expand(raw, old_bytes, new_bytes);
+        }
+        if (expanded) {
+            record_resize(raw, old_bytes, new_bytes);
+        }
+        return expanded;
+    }
+
+    // gives back the blocks past new_n objects
+    bool shrink(pointer ptr, size_t old_n, size_t new_n) {
+        const auto old_bytes = old_n * sizeof(T);
+        const auto new_bytes = new_n * sizeof(T);
+        const auto raw = std::to_address(ptr);
+        bool shrunk = false;
+        if (old_bytes >= large_threshold_) {
+            shrunk = new_bytes >= large_threshold_ && large_region::resize(raw, old_bytes, new_bytes, false) != nullptr;
+        } else {
+            auto owner = owner_of(raw);
+            shrunk = owner != nullptr && owner->try_shrink(raw, old_bytes, new_bytes);
+        }
+        if (shrunk) {
+            record_resize(raw, old_bytes, new_bytes);
+        }
+        return shrunk;
+    }
+
+    // realloc for trivially copyable objects: in place when possible,
+    // large allocations are moved by remapping their pages, anything
+    // else is copied into a new allocation
+    pointer reallocate(pointer ptr, size_t old_n, size_t new_n) requires std::is_trivially_copyable_v<T> {
+        const auto old_bytes = old_n * sizeof(T);
+        const auto new_bytes = new_n * sizeof(T);
+        if (old_bytes >= large_threshold_ && new_bytes >= large_threshold_) {
+            auto moved = large_region::resize(std::to_address(ptr), old_bytes, new_bytes, true);
+            if (moved == nullptr) {
+                throw std::bad_alloc{};
+            }
+            if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+                recorder->record_deallocate(std::to_address(ptr), old_bytes);
+                recorder->record_allocate(moved, new_bytes);
+            }
+            return make_pointer(moved, new_bytes);
+        }
+        if (new_n >= old_n ? expand(ptr, old_n, new_n) : shrink(ptr, old_n, new_n)) {
+            return ptr;
+        }
+        auto fresh = allocate(new_n);
+        std::memcpy(static_cast<void*>(std::to_address(fresh)), static_cast<const void*>(std::to_address(ptr)), std::min(old_bytes, new_bytes));
+        deallocate(ptr, old_n);
+        return fresh;
+    }
+
+    // count allocations of n objects each with a single ranking of the
+    // buckets, the buckets are filled in rank order one ledger pass each
+    // either all count pointers are written to out or bad_alloc is thrown
+    void allocate_batch(size_t n, size_t count, pointer* out) {
+        const auto bytes = n * sizeof(T);
+        if (bytes >= large_threshold_) {
+            for (size_t i = 0; i < count; ++i) {
+                try {
+                    out[i] = make_pointer(allocate_bytes(bytes).first, bytes);
+                } catch (const std::bad_alloc&) {
+                    deallocate_batch(out, i, n);
+                    throw;
+                }
+            }
+            return;
+        }
+        // the buckets write raw pointers, which become pointers once all are claimed
+        std::vector<void*> raw(count);
+        // bucket and end in raw of the runs each bucket wrote
+        std::vector<std::pair<size_t, size_t>> claimed;
+        size_t done = 0;
+        for (const auto& opt : rank(bytes)) {
+            if (done == count) {
+                break;
+            }
+            done += pool_[opt.index].allocate_batch(bytes, count - done, raw.data() + done);
+            claimed.emplace_back(opt.index, done);
+        }
+        // the buckets take the runs back directly, frees may be ignored
+        const auto undo = [&] {
+            size_t begin = 0;
+            for (const auto& [index, end] : claimed) {
+                pool_[index].undo_batch(raw.data() + begin, end - begin, bytes);
+                begin = end;
+            }
+        };
+        if (done < count) {
+            undo();
+            throw std::bad_alloc{};
+        }
+        if constexpr (std::is_pointer_v<pointer>) {
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = static_cast<T*>(raw[i]);
+            }
+        } else {
+            // a fancy pointer that can not point to a run fails the batch, as in make_pointer
+            try {
+                for (size_t i = 0; i < count; ++i) {
+                    out[i] = pointer(static_cast<T*>(raw[i]));
+                }
+            } catch (const std::exception&) {
+                undo();
+                throw std::bad_alloc{};
+            }
+        }
+        if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+            for (size_t i = 0; i < count; ++i) {
+                recorder->record_allocate(raw[i], bytes);
+            }
+        }
+    }
+
+    // frees count allocations of n objects each, the owning bucket is
+    // looked up once and only searched again when a pointer is not in it
+    void deallocate_batch(pointer* ptrs, size_t count, size_t n = 1) {
+        if (n * sizeof(T) >= large_threshold_) {
+            for (size_t i = 0; i < count; ++i) {
+                deallocate(ptrs[i], n);
+            }
+            return;
+        }
+        if (pool_.front().frees_ignored()) {
+            return;
+        }
+        const auto bytes = n * sizeof(T);
+        std::vector<void*> raw(count);
+        for (size_t i = 0; i < count; ++i) {
+            raw[i] = std::to_address(ptrs[i]);
+        }
+        if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+            for (size_t i = 0; i < count; ++i) {
+                recorder->record_deallocate(raw[i], bytes);
+            }
+        }
+        size_t begin = 0;
+        while (begin < count) {
+            auto owner = std::find_if(pool_.begin(), pool_.end(), [&](const bucket& b) {
+                return b.belongs(raw[begin]);
+            });
+            if (owner == pool_.end()) {
+                ++begin;
+                continue;
+            }
+            auto end = begin + 1;
+            while (end < count && owner->belongs(raw[end])) {
+                ++end;
+            }
+            owner->deallocate_batch(raw.data() + begin, end - begin, bytes);
+            begin = end;
+        }
+    }
+
+    void deallocate(pointer ptr, size_t n) {
+        deallocate_bytes(std::to_address(ptr), n * sizeof(T));
+    }
+
+    // wink-out teardown: after ignore_frees(true) containers of this pool
+    // can be destroyed (or abandoned) without freeing their nodes, then
+    // release_all frees the whole pool at once and ends ignoring frees
+    void ignore_frees(bool ignore) {
+        for (auto& bucket : pool_) {
+            bucket.ignore_frees(ignore);
+        }
+    }
+
+    // deferred bookkeeping of every bucket, a full pass each, see bucket::maintain
+    void maintain() {
+        for (auto& bucket : pool_) {
+            bucket.maintain();
+        }
+    }
+
+    void release_all(bool release_pages = false) {
+        for (auto& bucket : pool_) {
+            if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+                recorder->record_release(bucket.data(), bucket.data() + bucket.BlockSize * bucket.BlockCount);
+            }
+            bucket.reset(release_pages);
+        }
+    }
+
+    // equal allocators free each other's memory, so they also have to
+    // agree on which sizes go to large regions
+    template<typename U, typename P>
+    bool operator==(const MemoryPoolAllocator<U, bucket_count, P>& other) const {
+        return &pool_ == &other.pool_ && large_threshold_ == other.large_threshold_;
+    }
+
+private:
+    static bool has_persistent(const std::array<bucket, bucket_count>& pool) {
+        return std::any_of(pool.begin(), pool.end(), [](const bucket& b) {
+            return b.persistent();
+        });
+    }
+
+    // buckets ordered by how well they fit bytes
+    std::array<info, bucket_count> rank(size_t bytes) const {
         std::array<info, bucket_count> options;
         size_t index = 0;
         for (const auto& bucket : pool_) {
-            options[index].index = index;
-            if (bucket.BlockSize >= bytes) {
-                options[index].waste = bucket.BlockSize - bytes;
-                options[index].block_count = 1;
-            } else {
-                const auto n = 1 + ((bytes - 1) / bucket.BlockSize);
-                const auto mem_required = n * bucket.BlockSize;
-                options[index].waste = mem_required - bytes;
-                options[index].block_count = n;
-            }
+            options[index] = info::rank(index, bucket.BlockSize, bytes);
             ++index;
         }
 
         std::sort(options.begin(), options.end());
+        return options;
+    }
 
-        for (const auto& opt : options) {
+    // the bucket is nullptr for large regions
+    std::pair<void*, bucket*> allocate_bytes(size_t bytes) {
+        if (bytes >= large_threshold_) {
+            auto ptr = large_region::allocate(bytes);
+            if (ptr == nullptr) {
+                throw std::bad_alloc{};
+            }
+            if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+                recorder->record_allocate(ptr, bytes);
+            }
+            return {ptr, nullptr};
+        }
+        for (const auto& opt : rank(bytes)) {
             if (auto ptr = pool_[opt.index].allocate(bytes); ptr != nullptr) {
-                return static_cast<pointer>(ptr);
+                if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+                    recorder->record_allocate(ptr, bytes);
+                }
+                return {ptr, &pool_[opt.index]};
             }
         }
         throw std::bad_alloc{};
     }
 
-    void deallocate(pointer ptr, size_t n) {
+    // a resize in place is traced as a free of the old size and an
+    // allocation of the new one at the same address
+    void record_resize(const void* ptr, size_t old_bytes, size_t new_bytes) {
+        if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+            recorder->record_deallocate(ptr, old_bytes);
+            recorder->record_allocate(ptr, new_bytes);
+        }
+    }
+
+    void deallocate_bytes(void* raw, size_t bytes) {
+        // large regions are not part of the pool and always unmapped
+        if (bytes >= large_threshold_) {
+            if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+                recorder->record_deallocate(raw, bytes);
+            }
+            large_region::deallocate(raw, bytes);
+            return;
+        }
+        // ignore_frees is set for the whole pool, see ignore_frees
+        if (pool_.front().frees_ignored()) {
+            return;
+        }
+        if (auto recorder = trace_recorder_hook.load(std::memory_order_relaxed)) {
+            recorder->record_deallocate(raw, bytes);
+        }
         for (auto& bucket : pool_) {
-            if (bucket.belongs(static_cast<void*>(ptr))) {
-                bucket.deallocate(ptr, n);
+            if (bucket.belongs(raw)) {
+                bucket.deallocate(raw, bytes);
                 return;
             }
         }
     }
 
-private:
+    // a fancy pointer that can not point to the memory, such as a pool_ptr
+    // to a large region, fails the allocation and the memory goes back
+    pointer make_pointer(void* raw, size_t bytes) {
+        if constexpr (std::is_pointer_v<pointer>) {
+            return static_cast<T*>(raw);
+        } else {
+            try {
+                return pointer(static_cast<T*>(raw));
+            } catch (const std::exception&) {
+                deallocate_bytes(raw, bytes);
+                throw std::bad_alloc{};
+            }
+        }
+    }
+
+    bucket* owner_of(void* ptr) const {
+        for (auto& bucket : pool_) {
+            if (bucket.belongs(ptr)) {
+                return &bucket;
+            }
+        }
+        return nullptr;
+    }
+
     std::array<bucket, bucket_count>& pool_;
+    size_t large_threshold_;
 };
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "MemoryPoolAllocator.h"
+
+
+// Pool of objects of one type over a bucket with blocks of sizeof(T),
+// so create and destroy skip the ranking of MemoryPoolAllocator::allocate.
+// Destroyed slots are kept on a stack and handed out again first, the
+// last one freed is the first one reused while it is still in cache.
+// The stack has room for every slot from the start, so destroy never
+// allocates. With recycle the objects on that stack stay constructed
+// (slab caching): destroy does not run the destructor and recycled()
+// returns a cached object as it was left. That pays off for objects with
+// expensive constructors that can be reused as they are, such as buffers
+// that keep their capacity; create always constructs from its args
+template<typename T, bool recycle = false>
+class ObjectPool {
+public:
+    static constexpr size_t BlockSize = sizeof(T);
+
+    explicit ObjectPool(size_t capacity, commit_options commit = {})
+        : bucket_(BlockSize, capacity, bucket_policy::first_fit, commit) {
+        cache_.reserve(capacity);
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // objects still alive are not destroyed, their memory goes with the bucket
+    ~ObjectPool() {
+        if constexpr (recycle) {
+            for (auto object : cache_) {
+                std::destroy_at(object);
+            }
+        }
+    }
+
+    // throws bad_alloc when the bucket is full
+    template<typename... Args>
+    T* create(Args&&... args) {
+        if (!cache_.empty()) {
+            const auto slot = cache_.back();
+            cache_.pop_back();
+            if constexpr (recycle) {
+                // the cached object is replaced, a throw leaves an empty slot
+                std::destroy_at(slot);
+                try {
+                    return std::construct_at(slot, std::forward<Args>(args)...);
+                } catch (...) {
+                    bucket_.deallocate(slot, BlockSize);
+                    throw;
+                }
+            } else {
+                try {
+                    return std::construct_at(slot, std::forward<Args>(args)...);
+                } catch (...) {
+                    // the stack just had room for it
+                    cache_.push_back(slot);
+                    throw;
+                }
+            }
+        }
+        auto slot = static_cast<T*>(bucket_.allocate(BlockSize));
+        if (slot == nullptr) {
+            throw std::bad_alloc{};
+        }
+        try {
+            return std::construct_at(slot, std::forward<Args>(args)...);
+        } catch (...) {
+            bucket_.deallocate(slot, BlockSize);
+            throw;
+        }
+    }
+
+    // the last destroyed object as it was left, nullptr when none is cached
+    T* recycled() requires recycle {
+        if (cache_.empty()) {
+            return nullptr;
+        }
+        const auto object = cache_.back();
+        cache_.pop_back();
+        return object;
+    }
+
+    void destroy(T* object) {
+        if constexpr (!recycle) {
+            std::destroy_at(object);
+        }
+        cache_.push_back(object);
+    }
+
+    // gives the cached slots back to the bucket, destroying recycled objects
+    void shrink() {
+        for (auto slot : cache_) {
+            if constexpr (recycle) {
+                std::destroy_at(slot);
+            }
+            bucket_.deallocate(slot, BlockSize);
+        }
+        cache_.clear();
+    }
+
+    // objects created and not destroyed
+    size_t size() const {
+        return bucket_.BlockCount - bucket_.free_blocks() - cache_.size();
+    }
+
+    size_t cached() const {
+        return cache_.size();
+    }
+
+    bucket& storage() {
+        return bucket_;
+    }
+
+private:
+    bucket bucket_;
+    std::vector<T*> cache_;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+
+// Fancy pointer that stores the distance from itself to the object it
+// points to instead of its address. Objects linked with offset_ptr stay
+// valid when the memory holding them is mapped at another address, such
+// as a persistent bucket reopened after a restart, so it is meant as
+// the pointer of MemoryPoolAllocator<T, N, offset_ptr<T>>.
+// Copying recomputes the distance for the new location. The distance 1
+// means nullptr, an offset_ptr can not point to the byte right after itself
+template<typename T>
+class offset_ptr {
+public:
+    typedef T                                   element_type;
+    typedef std::remove_cv_t<T>                 value_type;
+    typedef std::ptrdiff_t                      difference_type;
+    typedef offset_ptr<T>                       pointer;
+    typedef std::add_lvalue_reference_t<T>      reference;
+    typedef std::random_access_iterator_tag     iterator_category;
+
+    template<typename U>
+    using rebind = offset_ptr<U>;
+
+    template<typename U>
+    friend class offset_ptr;
+
+    offset_ptr() = default;
+
+    offset_ptr(std::nullptr_t) {}
+
+    offset_ptr(T* ptr) {
+        set(ptr);
+    }
+
+    offset_ptr(const offset_ptr& other) {
+        set(other.get());
+    }
+
+    template<typename U> requires std::is_convertible_v<U*, T*>
+    offset_ptr(const offset_ptr<U>& other) {
+        set(other.get());
+    }
+
+    // static_cast, e.g. from offset_ptr<void> or from a base to a derived class
+    template<typename U> requires (!std::is_convertible_v<U*, T*>)
+    explicit offset_ptr(const offset_ptr<U>& other) {
+        set(static_cast<T*>(other.get()));
+    }
+
+    offset_ptr& operator=(const offset_ptr& other) {
+        set(other.get());
+        return *this;
+    }
+
+    offset_ptr& operator=(T* ptr) {
+        set(ptr);
+        return *this;
+    }
+
+    T* get() const {
+        if (offset_ == null_offset) {
+            return nullptr;
+        }
+        return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(this) + offset_);
+    }
+
+    // for std::pointer_traits and std::to_address
+    template<typename U = T> requires (!std::is_void_v<U>)
+    static offset_ptr pointer_to(U& r) {
+        return offset_ptr(std::addressof(r));
+    }
+
+    reference operator*() const requires (!std::is_void_v<T>) {
+        return *get();
+    }
+
+    T* operator->() const {
+        return get();
+    }
+
+    reference operator[](difference_type i) const requires (!std::is_void_v<T>) {
+        return get()[i];
+    }
+
+    explicit operator bool() const {
+        return offset_ != null_offset;
+    }
+
+    offset_ptr& operator+=(difference_type n) {
+        offset_ += n * static_cast<difference_type>(sizeof(T));
+        return *this;
+    }
+
+    offset_ptr& operator-=(difference_type n) {
+        offset_ -= n * static_cast<difference_type>(sizeof(T));
+        return *this;
+    }
+
+    offset_ptr& operator++() { return *this += 1; }
+    offset_ptr& operator--() { return *this -= 1; }
+    offset_ptr operator++(int) { auto old = *this; ++*this; return old; }
+    offset_ptr operator--(int) { auto old = *this; --*this; return old; }
+
+    friend offset_ptr operator+(offset_ptr ptr, difference_type n) { return ptr += n; }
+    friend offset_ptr operator+(difference_type n, offset_ptr ptr) { return ptr += n; }
+    friend offset_ptr operator-(offset_ptr ptr, difference_type n) { return ptr -= n; }
+
+    friend difference_type operator-(const offset_ptr& lhs, const offset_ptr& rhs) {
+        return lhs.get() - rhs.get();
+    }
+
+    friend bool operator==(const offset_ptr& lhs, const offset_ptr& rhs) {
+        return lhs.get() == rhs.get();
+    }
+
+    friend bool operator==(const offset_ptr& lhs, std::nullptr_t) {
+        return !lhs;
+    }
+
+    friend std::strong_ordering operator<=>(const offset_ptr& lhs, const offset_ptr& rhs) {
+        return std::compare_three_way{}(lhs.get(), rhs.get());
+    }
+
+private:
+    static constexpr difference_type null_offset = 1;
+
+    void set(T* ptr) {
+        offset_ = ptr == nullptr ? null_offset
+                                 : static_cast<difference_type>(reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(this));
+    }
+
+    difference_type offset_{null_offset};
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sys/rseq.h>
+#include <sys/sysinfo.h>
+#if defined(__SANITIZE_THREAD__)
+#include <sanitizer/tsan_interface.h>
+#endif
+
+#include "MemoryPoolAllocator.h"
+
+
+// Per-cpu caches of free blocks in front of a bucket shared by many
+// threads. Every cpu has a small stack of runs of one size; allocate pops
+// from the stack of the cpu the thread runs on and deallocate pushes to
+// it inside a restartable sequence (rseq): if the thread is preempted or
+// migrated before the single commit store, the kernel restarts the
+// sequence, so the stacks need neither atomics nor locks and their number
+// follows the cpus, not the threads. The bucket itself is only touched
+// under lock, to refill an empty stack with half of capacity runs
+// (bucket::allocate_batch) or to take a run when the stack is full.
+// Without rseq (other architectures, or glibc.pthread.rseq=0) every call
+// goes to the bucket under lock
+template<size_t capacity = 64>
+class percpu_cache {
+public:
+    // runs of bytes from shared, which lock guards
+    percpu_cache(bucket& shared, std::mutex& lock, size_t bytes)
+        : shared_(shared)
+        , lock_(lock)
+        , bytes_(bytes)
+        , cpus_(static_cast<size_t>(get_nprocs_conf()))
+        , slots_(static_cast<cpu_slot*>(std::aligned_alloc(alignof(cpu_slot), cpus_ * sizeof(cpu_slot)))) {
+        if (slots_ == nullptr) {
+            throw std::bad_alloc{};
+        }
+        for (size_t cpu = 0; cpu < cpus_; ++cpu) {
+            new (&slots_[cpu]) cpu_slot;
+        }
+    }
+
+    percpu_cache(const percpu_cache&) = delete;
+    percpu_cache& operator=(const percpu_cache&) = delete;
+
+    // no thread may use the cache any more, the runs go back to the bucket
+    ~percpu_cache() {
+        flush();
+        std::free(slots_);
+    }
+
+    // nullptr when the bucket is exhausted
+    void* allocate() {
+        if (auto ptr = pop(); ptr != nullptr) {
+            handed_over(ptr);
+            return ptr;
+        }
+        return refill();
+    }
+
+    void deallocate(void* ptr) {
+        handing_over(ptr);
+        if (!push(ptr)) {
+            std::lock_guard guard(lock_);
+            shared_.deallocate(ptr, bytes_);
+        }
+    }
+
+    // returns every cached run to the bucket, while no thread uses the cache
+    void flush() {
+        std::lock_guard guard(lock_);
+        for (size_t cpu = 0; cpu < cpus_; ++cpu) {
+            auto& slot = slots_[cpu];
+            shared_.deallocate_batch(slot.items, slot.count, bytes_);
+            slot.count = 0;
+        }
+    }
+
+    // runs cached for cpu, for statistics
+    size_t cached(size_t cpu) const {
+        return slots_[cpu].count;
+    }
+
+    // false when the calling thread falls back to the bucket under lock
+    static bool available() {
+#if defined(__x86_64__)
+        return registered();
+#else
+        return false;
+#endif
+    }
+
+private:
+    // count is the commit word of both sequences, items above it are garbage
+    struct alignas(64) cpu_slot {
+        uint64_t count{0};
+        void* items[capacity];
+    };
+
+    static struct rseq* current_rseq() {
+        return reinterpret_cast<struct rseq*>(static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+    }
+
+    // ThreadSanitizer does not see the order the commit store of a
+    // sequence gives to a run that moves from one thread to another
+    static void handing_over([[maybe_unused]] void* ptr) {
+#if defined(__SANITIZE_THREAD__)
+        __tsan_release(ptr);
+#endif
+    }
+
+    static void handed_over([[maybe_unused]] void* ptr) {
+#if defined(__SANITIZE_THREAD__)
+        __tsan_acquire(ptr);
+#endif
+    }
+
+    static bool registered() {
+        // cpu_id is negative until the thread registered, or when that failed
+        return __rseq_size > 0 && static_cast<int32_t>(current_rseq()->cpu_id) >= 0;
+    }
+
+    // refills the stack of the current cpu, one run is returned right away
+    void* refill() {
+        void* runs[capacity / 2 + 1];
+        size_t count;
+        {
+            std::lock_guard guard(lock_);
+            count = shared_.allocate_batch(bytes_, registered() ? capacity / 2 + 1 : 1, runs);
+        }
+        if (count == 0) {
+            return nullptr;
+        }
+        size_t i = 1;
+        while (i < count && (handing_over(runs[i]), push(runs[i]))) {
+            ++i;
+        }
+        // the stack was filled meanwhile by another thread of this cpu
+        if (i < count) {
+            std::lock_guard guard(lock_);
+            shared_.deallocate_batch(runs + i, count - i, bytes_);
+        }
+        return runs[0];
+    }
+
+    // nullptr when the stack of the current cpu is empty
+    void* pop() {
+#if defined(__x86_64__)
+        if (!registered()) {
+            return nullptr;
+        }
+        void* item;
+        // The rseq_cs descriptor (label 3) covers [1, 2): the kernel sends
+        // the thread to 4 when it is preempted, migrated or signalled in
+        // there, and 4 starts over. The signature in front of 4 is the one
+        // glibc registered. The store to count is the commit
+        asm volatile(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "5:\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, 8(%[rseq])\n\t"
+            "1:\n\t"
+            "movl 4(%[rseq]), %%eax\n\t"
+            "imulq %[stride], %%rax\n\t"
+            "addq %[slots], %%rax\n\t"
+            "movq (%%rax), %%rcx\n\t"
+            "testq %%rcx, %%rcx\n\t"
+            "jz 6f\n\t"
+            "movq (%%rax, %%rcx, 8), %[item]\n\t"
+            "subq $1, %%rcx\n\t"
+            "movq %%rcx, (%%rax)\n\t"
+            "2:\n\t"
+            "jmp 7f\n\t"
+            "6:\n\t"
+            "xorl %k[item], %k[item]\n\t"
+            "jmp 7f\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp 5b\n\t"
+            ".popsection\n\t"
+            "7:\n\t"
+            : [item] "=&r"(item)
+            : [rseq] "r"(current_rseq()), [slots] "r"(slots_), [stride] "r"(sizeof(cpu_slot))
+            : "rax", "rcx", "memory", "cc");
+        return item;
+#else
+        return nullptr;
+#endif
+    }
+
+    // false when the stack of the current cpu is full
+    bool push(void* ptr) {
+#if defined(__x86_64__)
+        if (!registered()) {
+            return false;
+        }
+        uint32_t done;
+        // same layout as pop, items[count] is written before the commit
+        asm volatile(
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            "5:\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, 8(%[rseq])\n\t"
+            "1:\n\t"
+            "movl 4(%[rseq]), %%eax\n\t"
+            "imulq %[stride], %%rax\n\t"
+            "addq %[slots], %%rax\n\t"
+            "movq (%%rax), %%rcx\n\t"
+            "cmpq %[capacity], %%rcx\n\t"
+            "jae 6f\n\t"
+            "movq %[item], 8(%%rax, %%rcx, 8)\n\t"
+            "addq $1, %%rcx\n\t"
+            "movq %%rcx, (%%rax)\n\t"
+            "2:\n\t"
+            "movl $1, %[done]\n\t"
+            "jmp 7f\n\t"
+            "6:\n\t"
+            "movl $0, %[done]\n\t"
+            "jmp 7f\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp 5b\n\t"
+            ".popsection\n\t"
+            "7:\n\t"
+            : [done] "=&r"(done)
+            : [rseq] "r"(current_rseq()), [slots] "r"(slots_), [stride] "r"(sizeof(cpu_slot)),
+              [item] "r"(ptr), [capacity] "i"(capacity)
+            : "rax", "rcx", "memory", "cc");
+        return done != 0;
+#else
+        return false;
+#endif
+    }
+
+    bucket& shared_;
+    std::mutex& lock_;
+    const size_t bytes_;
+    const size_t cpus_;
+    cpu_slot* slots_;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "MemoryPoolAllocator.h"
+
+
+// Runs a bucket::maintain pass for every bucket of a pool on a background
+// thread every period. Buckets are not thread safe, so the maintainer
+// takes the lock that guards the pool, but only for slices of budget
+// ledger blocks at a time: an allocating thread waits for at most one
+// slice (and the pages whose decay ended in it), not for a scan of a
+// whole bucket. Pools used by a single thread call
+// MemoryPoolAllocator::maintain when idle instead. A budget of 0 would
+// never finish a pass and throws invalid_argument
+template<size_t bucket_count>
+class pool_maintainer {
+public:
+    pool_maintainer(std::array<bucket, bucket_count>& pool, std::mutex& lock, std::chrono::milliseconds period,
+                    size_t budget = size_t{1} << 16)
+        : thread_([this, &pool, &lock, period, budget = checked_budget(budget)](std::stop_token stop) {
+            std::mutex wait_mutex;
+            std::unique_lock wait_lock(wait_mutex);
+            while (true) {
+                // wakes up early only when the thread is asked to stop
+                wake_.wait_for(wait_lock, stop, period, [] { return false; });
+                if (stop.stop_requested()) {
+                    return;
+                }
+                for (auto& bucket : pool) {
+                    bool done = false;
+                    while (!done && !stop.stop_requested()) {
+                        std::lock_guard guard(lock);
+                        done = bucket.maintain(budget);
+                    }
+                }
+            }
+        }) {}
+
+    pool_maintainer(const pool_maintainer&) = delete;
+    pool_maintainer& operator=(const pool_maintainer&) = delete;
+
+private:
+    static size_t checked_budget(size_t budget) {
+        if (budget == 0) {
+            throw std::invalid_argument("pool_maintainer needs a budget of at least one block");
+        }
+        return budget;
+    }
+
+    std::condition_variable_any wake_;
+    // stopped and joined on destruction, declared last so it goes first
+    std::jthread thread_;
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include "MemoryPoolAllocator.h"
+
+
+// Buckets that pool_ptr can point into. A pool_ptr names its bucket by
+// the position in this table, so the buckets of node containers that
+// use pool_ptr are registered before the first allocation and stay
+// registered while the containers live
+constexpr size_t max_registered_buckets = 16;
+
+inline std::array<std::atomic<bucket*>, max_registered_buckets> registered_buckets{};
+
+// the id of b, throws length_error when the table is full
+inline uint32_t register_bucket(bucket& b) {
+    for (uint32_t id = 0; id < max_registered_buckets; ++id) {
+        bucket* expected = nullptr;
+        if (registered_buckets[id].compare_exchange_strong(expected, &b) || expected == &b) {
+            return id;
+        }
+    }
+    throw std::length_error("no free slot for another bucket in registered_buckets");
+}
+
+inline void unregister_bucket(bucket& b) {
+    for (auto& slot : registered_buckets) {
+        bucket* expected = &b;
+        slot.compare_exchange_strong(expected, nullptr);
+    }
+}
+
+template<size_t bucket_count>
+void register_pool(std::array<bucket, bucket_count>& pool) {
+    for (auto& b : pool) {
+        register_bucket(b);
+    }
+}
+
+// Fancy pointer of 32 bits for node containers in registered buckets:
+// 4 bits of bucket id and 28 bits of position from the data of the
+// bucket, counted in units of alignof(T), which keeps pointer arithmetic
+// over elements exact. Meant as the pointer of
+// MemoryPoolAllocator<T, N, pool_ptr<T>> to halve the links of nodes.
+// Every bucket holds up to 2^28 - 1 units (2 GB for 8 byte aligned T),
+// and memory outside the registered buckets, like large regions of
+// the allocator, can not be pointed to: the conversion throws out_of_range
+// (and MemoryPoolAllocator::allocate bad_alloc). An address that is not a
+// multiple of alignof(T) from the data of its bucket has no position
+// either, the conversion throws invalid_argument
+template<typename T>
+class pool_ptr {
+public:
+    typedef T                                   element_type;
+    typedef std::remove_cv_t<T>                 value_type;
+    typedef std::ptrdiff_t                      difference_type;
+    typedef pool_ptr<T>                         pointer;
+    typedef std::add_lvalue_reference_t<T>      reference;
+    typedef std::random_access_iterator_tag     iterator_category;
+
+    template<typename U>
+    using rebind = pool_ptr<U>;
+
+    template<typename U>
+    friend class pool_ptr;
+
+    pool_ptr() = default;
+
+    pool_ptr(std::nullptr_t) {}
+
+    pool_ptr(T* ptr) : value_(encode(ptr)) {}
+
+    template<typename U> requires std::is_convertible_v<U*, T*>
+    pool_ptr(const pool_ptr<U>& other) : value_(encode(other.get())) {}
+
+    // static_cast, e.g. from pool_ptr<void> or from a base to a derived class
+    template<typename U> requires (!std::is_convertible_v<U*, T*>)
+    explicit pool_ptr(const pool_ptr<U>& other) : value_(encode(static_cast<T*>(other.get()))) {}
+
+    T* get() const {
+        if (value_ == 0) {
+            return nullptr;
+        }
+        const auto position = value_ - 1;
+        auto owner = registered_buckets[position >> index_bits].load(std::memory_order_relaxed);
+        return reinterpret_cast<T*>(owner->data() + (position & index_mask) * unit);
+    }
+
+    // for std::pointer_traits and std::to_address
+    template<typename U = T> requires (!std::is_void_v<U>)
+    static pool_ptr pointer_to(U& r) {
+        return pool_ptr(std::addressof(r));
+    }
+
+    reference operator*() const requires (!std::is_void_v<T>) {
+        return *get();
+    }
+
+    T* operator->() const {
+        return get();
+    }
+
+    reference operator[](difference_type i) const requires (!std::is_void_v<T>) {
+        return get()[i];
+    }
+
+    explicit operator bool() const {
+        return value_ != 0;
+    }
+
+    // moves within the bucket, the id bits are not touched; a position
+    // that can not be encoded, before the data of the bucket or 2^28 - 1
+    // units past it, throws out_of_range
+    pool_ptr& operator+=(difference_type n) requires (!std::is_void_v<T>) {
+        if (n == 0) {
+            return *this;
+        }
+        const auto position = value_ - 1;
+        const auto index = static_cast<difference_type>(position & index_mask) + n * static_cast<difference_type>(sizeof(T) / unit);
+        if (value_ == 0 || index < 0 || index >= static_cast<difference_type>(index_mask)) {
+            throw std::out_of_range("pool_ptr arithmetic leaves the positions of its bucket");
+        }
+        value_ = ((position & ~index_mask) | static_cast<uint32_t>(index)) + 1;
+        return *this;
+    }
+
+    pool_ptr& operator-=(difference_type n) requires (!std::is_void_v<T>) {
+        return *this += -n;
+    }
+
+    pool_ptr& operator++() { return *this += 1; }
+    pool_ptr& operator--() { return *this -= 1; }
+    pool_ptr operator++(int) { auto old = *this; ++*this; return old; }
+    pool_ptr operator--(int) { auto old = *this; --*this; return old; }
+
+    friend pool_ptr operator+(pool_ptr ptr, difference_type n) { return ptr += n; }
+    friend pool_ptr operator+(difference_type n, pool_ptr ptr) { return ptr += n; }
+    friend pool_ptr operator-(pool_ptr ptr, difference_type n) { return ptr -= n; }
+
+    friend difference_type operator-(const pool_ptr& lhs, const pool_ptr& rhs) {
+        return lhs.get() - rhs.get();
+    }
+
+    // by address, the end of one bucket may be the start of the next
+    friend bool operator==(const pool_ptr& lhs, const pool_ptr& rhs) {
+        return lhs.get() == rhs.get();
+    }
+
+    friend bool operator==(const pool_ptr& lhs, std::nullptr_t) {
+        return !lhs;
+    }
+
+    friend std::strong_ordering operator<=>(const pool_ptr& lhs, const pool_ptr& rhs) {
+        return std::compare_three_way{}(lhs.get(), rhs.get());
+    }
+
+private:
+    static constexpr size_t unit = alignof(std::conditional_t<std::is_void_v<T>, char, T>);
+    static constexpr uint32_t index_bits = 28;
+    static constexpr uint32_t index_mask = (uint32_t{1} << index_bits) - 1;
+
+    // (id << 28 | index) + 1, 0 is nullptr
+    static uint32_t encode(T* ptr) {
+        if (ptr == nullptr) {
+            return 0;
+        }
+        const auto address = reinterpret_cast<const uint8_t*>(ptr);
+        for (uint32_t id = 0; id < max_registered_buckets; ++id) {
+            auto owner = registered_buckets[id].load(std::memory_order_relaxed);
+            // one past the end of a bucket is a valid position as well
+            if (owner != nullptr && owner->data() <= address
+                && address <= owner->data() + owner->BlockSize * owner->BlockCount) {
+                const auto offset = static_cast<size_t>(address - owner->data());
+                if (offset % unit != 0) {
+                    throw std::invalid_argument("pool_ptr to an address that is not aligned for its type");
+                }
+                const auto index = offset / unit;
+                if (index < index_mask) {
+                    return ((id << index_bits) | static_cast<uint32_t>(index)) + 1;
+                }
+            }
+        }
+        throw std::out_of_range("pool_ptr to memory outside the registered buckets");
+    }
+
+    uint32_t value_{0};
+};
+
+static_assert(sizeof(pool_ptr<int>) == 4);
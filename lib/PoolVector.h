@@ -0,0 +1,151 @@
+#pragma once
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "MemoryPoolAllocator.h"
+
+
+// Growable array on top of MemoryPoolAllocator. When it runs out of
+// capacity it first tries to grow its run in place through the bucket
+// ledger, only when the following blocks are taken it allocates a new
+// run and relocates. Trivially copyable elements are relocated like
+// realloc does (MemoryPoolAllocator::reallocate, pages of large runs are
+// remapped, small runs are copied with one memcpy), others are moved one by one
+template<typename T, size_t bucket_count>
+class pool_vector {
+public:
+    typedef T                                   value_type;
+    typedef MemoryPoolAllocator<T, bucket_count> allocator_type;
+    typedef T*                                  iterator;
+    typedef const T*                            const_iterator;
+
+    explicit pool_vector(const allocator_type& alloc) : alloc_(alloc) {}
+
+    pool_vector(const pool_vector&) = delete;
+    pool_vector& operator=(const pool_vector&) = delete;
+
+    pool_vector(pool_vector&& other) noexcept
+        : alloc_(other.alloc_)
+        , data_(std::exchange(other.data_, nullptr))
+        , size_(std::exchange(other.size_, 0))
+        , capacity_(std::exchange(other.capacity_, 0)) {}
+
+    ~pool_vector() {
+        clear();
+        if (data_ != nullptr) {
+            alloc_.deallocate(data_, capacity_);
+        }
+    }
+
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {
+        emplace_back(std::move(value));
+    }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (size_ == capacity_) {
+            // args may refer to an element, which grow moves or frees
+            T value(std::forward<Args>(args)...);
+            grow(capacity_ == 0 ? 1 : 2 * capacity_);
+            auto slot = std::construct_at(data_ + size_, std::move(value));
+            ++size_;
+            return *slot;
+        }
+        auto slot = std::construct_at(data_ + size_, std::forward<Args>(args)...);
+        ++size_;
+        return *slot;
+    }
+
+    void pop_back() {
+        --size_;
+        std::destroy_at(data_ + size_);
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity > capacity_) {
+            grow(capacity);
+        }
+    }
+
+    // returns the unused tail of the run to the bucket when it can
+    void shrink_to_fit() {
+        if (data_ == nullptr || size_ == capacity_) {
+            return;
+        }
+        if (size_ == 0) {
+            alloc_.deallocate(data_, capacity_);
+            data_ = nullptr;
+            capacity_ = 0;
+        } else if (alloc_.shrink(data_, capacity_, size_)) {
+            capacity_ = size_;
+        }
+    }
+
+    void clear() {
+        std::destroy(begin(), end());
+        size_ = 0;
+    }
+
+    T& operator[](size_t i) { return data_[i]; }
+    const T& operator[](size_t i) const { return data_[i]; }
+    T& back() { return data_[size_ - 1]; }
+    T* data() { return data_; }
+    const T* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    iterator begin() { return data_; }
+    iterator end() { return data_ + size_; }
+    const_iterator begin() const { return data_; }
+    const_iterator end() const { return data_ + size_; }
+
+private:
+    void grow(size_t capacity) {
+        if (data_ == nullptr) {
+            const auto fresh = alloc_.allocate_at_least(capacity);
+            data_ = fresh.ptr;
+            capacity_ = fresh.count;
+            return;
+        }
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            // in place, by remapping pages of large runs or with one memcpy
+            data_ = alloc_.reallocate(data_, capacity_, capacity);
+            capacity_ = capacity;
+        } else {
+            if (alloc_.expand(data_, capacity_, capacity)) {
+                capacity_ = capacity;
+                return;
+            }
+            // elements are copied when their move may throw, as std::vector
+            // does, so a throw leaves the vector as it was
+            const auto fresh = alloc_.allocate_at_least(capacity);
+            size_t relocated = 0;
+            try {
+                for (; relocated < size_; ++relocated) {
+                    std::construct_at(fresh.ptr + relocated, std::move_if_noexcept(data_[relocated]));
+                }
+            } catch (...) {
+                std::destroy(fresh.ptr, fresh.ptr + relocated);
+                alloc_.deallocate(fresh.ptr, fresh.count);
+                throw;
+            }
+            std::destroy(data_, data_ + size_);
+            alloc_.deallocate(data_, capacity_);
+            data_ = fresh.ptr;
+            capacity_ = fresh.count;
+        }
+    }
+
+    allocator_type alloc_;
+    T* data_{nullptr};
+    size_t size_{0};
+    size_t capacity_{0};
+};
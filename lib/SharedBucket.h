@@ -0,0 +1,352 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "OffsetPtr.h"
+
+
+// Start of the shared memory of a shared_bucket, followed by the ledger
+// and the data. Every process maps it at its own address, so it only
+// holds offsets, and the ledger is a row of atomic words: allocate
+// claims a run of up to 64 blocks inside one word with one compare and
+// swap, deallocate clears it with fetch_and, no lock is shared between
+// the processes. Longer runs start at a word boundary and claim their
+// words one after another, giving them back when another process took
+// one of them first
+struct shared_segment {
+    static constexpr size_t word_bits = 64;
+
+    char magic[4]{'M', 'P', 'S', 'B'};
+    uint32_t version{1};
+    uint64_t block_size{0};
+    uint64_t block_count{0};
+    uint64_t ledger_offset{0};
+    uint64_t data_offset{0};
+    // 0 while the memory is empty, 1 while the process that claimed it
+    // initializes it, 2 once it is ready
+    std::atomic<uint32_t> ready{0};
+    // ledger word where the last allocation succeeded, the next search starts there
+    std::atomic<uint64_t> hint{0};
+    std::atomic<uint64_t> used{0};
+    // offset of the root object in the data + 1, 0 when there is none
+    std::atomic<uint64_t> root{0};
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the shared ledger needs lock free 64 bit atomics");
+
+    static size_t words_for(size_t block_count) {
+        return (block_count + word_bits - 1) / word_bits;
+    }
+
+    std::atomic<uint64_t>* ledger() {
+        return reinterpret_cast<std::atomic<uint64_t>*>(reinterpret_cast<uint8_t*>(this) + ledger_offset);
+    }
+
+    uint8_t* data() {
+        return reinterpret_cast<uint8_t*>(this) + data_offset;
+    }
+
+    bool belongs(void* ptr) {
+        return (data() <= ptr) && (ptr < data() + block_size * block_count);
+    }
+
+    // nullptr when no word has n free blocks in a row
+    void* allocate(size_t bytes) {
+        const auto n = blocks_for(bytes);
+        if (n > word_bits) {
+            return allocate_words(n);
+        }
+        const auto mask = n == word_bits ? ~uint64_t{0} : (uint64_t{1} << n) - 1;
+        const auto words = words_for(block_count);
+        const auto start = hint.load(std::memory_order_relaxed);
+        for (size_t k = 0; k < words; ++k) {
+            const auto w = (start + k) % words;
+            auto& word = ledger()[w];
+            auto current = word.load(std::memory_order_relaxed);
+            while (current != ~uint64_t{0}) {
+                const auto shift = free_run(current, n, mask);
+                if (shift == word_bits) {
+                    break;
+                }
+                // another process may have taken blocks of the word meanwhile
+                if (word.compare_exchange_weak(current, current | (mask << shift), std::memory_order_acquire,
+                                               std::memory_order_relaxed)) {
+                    hint.store(w, std::memory_order_relaxed);
+                    used.fetch_add(n, std::memory_order_relaxed);
+                    return data() + (w * word_bits + shift) * block_size;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void deallocate(void* ptr, size_t bytes) {
+        const auto n = blocks_for(bytes);
+        const auto index = static_cast<size_t>(static_cast<uint8_t*>(ptr) - data()) / block_size;
+        release(index, n);
+        used.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    size_t free_blocks() const {
+        return block_count - used.load(std::memory_order_relaxed);
+    }
+
+private:
+    size_t blocks_for(size_t bytes) const {
+        return bytes == 0 ? 1 : 1 + ((bytes - 1) / block_size);
+    }
+
+    static uint64_t low_bits(size_t n) {
+        return n >= word_bits ? ~uint64_t{0} : (uint64_t{1} << n) - 1;
+    }
+
+    // runs of more than 64 blocks: whole free words from a word boundary
+    // and the low blocks of the word after them
+    void* allocate_words(size_t n) {
+        const auto words = words_for(block_count);
+        const auto span = words_for(n);
+        for (size_t w = 0; w + span <= words; ++w) {
+            size_t claimed = 0;
+            for (; claimed < span; ++claimed) {
+                auto& word = ledger()[w + claimed];
+                const auto mask = low_bits(std::min(n - claimed * word_bits, word_bits));
+                auto current = word.load(std::memory_order_relaxed);
+                while ((current & mask) == 0
+                       && !word.compare_exchange_weak(current, current | mask, std::memory_order_acquire,
+                                                      std::memory_order_relaxed)) {}
+                if ((current & mask) != 0) {
+                    break;
+                }
+            }
+            if (claimed == span) {
+                used.fetch_add(n, std::memory_order_relaxed);
+                return data() + w * word_bits * block_size;
+            }
+            release(w * word_bits, claimed * word_bits);
+            // the word that was taken can not start the run either
+            w += claimed;
+        }
+        return nullptr;
+    }
+
+    // clears n blocks from index on, word by word
+    void release(size_t index, size_t n) {
+        while (n > 0) {
+            const auto offset = index % word_bits;
+            const auto count = std::min(n, word_bits - offset);
+            ledger()[index / word_bits].fetch_and(~(low_bits(count) << offset), std::memory_order_release);
+            index += count;
+            n -= count;
+        }
+    }
+
+    // lowest bit where n free blocks start in word, word_bits when there is none
+    static size_t free_run(uint64_t word, size_t n, uint64_t mask) {
+        size_t shift = std::countr_one(word);
+        while (shift + n <= word_bits) {
+            const auto taken = word & (mask << shift);
+            if (taken == 0) {
+                return shift;
+            }
+            // continue after the highest taken block of the window
+            shift = word_bits - static_cast<size_t>(std::countl_zero(taken));
+            shift += std::countr_one(shift == word_bits ? ~uint64_t{0} : word >> shift);
+        }
+        return word_bits;
+    }
+};
+
+// A bucket in memory shared by the processes of a host: a POSIX shared
+// memory object (shm_open) found by name, or a memfd passed to the other
+// processes. Every process sizes the memory, the one that claims the
+// empty segment with a compare and swap initializes it and the others
+// wait until it is ready. Objects in the bucket link to each other
+// with offset_ptr and are found through set_root, the memory lives on
+// until remove() (or the last memfd descriptor is closed)
+class shared_bucket {
+public:
+    shared_bucket(const std::string& name, size_t block_size, size_t block_count) {
+        const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open shared memory " + name);
+        }
+        try {
+            attach(fd, block_size, block_count);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    }
+
+    // fd is not closed, the memory is initialized when the file is empty
+    shared_bucket(int fd, size_t block_size, size_t block_count) {
+        attach(fd, block_size, block_count);
+    }
+
+    shared_bucket(const shared_bucket&) = delete;
+    shared_bucket& operator=(const shared_bucket&) = delete;
+
+    ~shared_bucket() {
+        munmap(segment_, size_);
+    }
+
+    static void remove(const std::string& name) {
+        shm_unlink(name.c_str());
+    }
+
+    shared_segment& segment() const {
+        return *segment_;
+    }
+
+    void* allocate(size_t bytes) {
+        return segment_->allocate(bytes);
+    }
+
+    void deallocate(void* ptr, size_t bytes) {
+        segment_->deallocate(ptr, bytes);
+    }
+
+    bool belongs(void* ptr) const {
+        return segment_->belongs(ptr);
+    }
+
+    size_t free_blocks() const {
+        return segment_->free_blocks();
+    }
+
+    void* root() const {
+        const auto root = segment_->root.load(std::memory_order_acquire);
+        return root == 0 ? nullptr : segment_->data() + (root - 1);
+    }
+
+    void set_root(void* ptr) {
+        segment_->root.store(ptr == nullptr ? 0 : static_cast<size_t>(static_cast<uint8_t*>(ptr) - segment_->data()) + 1,
+                             std::memory_order_release);
+    }
+
+private:
+    void attach(int fd, size_t block_size, size_t block_count) {
+        const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const auto round_up = [](size_t bytes, size_t to) { return (bytes + to - 1) & ~(to - 1); };
+        const auto ledger_offset = round_up(sizeof(shared_segment), alignof(std::atomic<uint64_t>));
+        const auto data_offset = round_up(ledger_offset + shared_segment::words_for(block_count) * sizeof(uint64_t), page);
+        size_ = data_offset + block_size * block_count;
+        struct stat status {};
+        if (fstat(fd, &status) != 0) {
+            throw std::runtime_error("cannot stat shared memory");
+        }
+        // every process that finds the memory empty extends it to its
+        // size, which never shrinks it or overwrites what another process
+        // wrote; memory of another size holds another layout
+        if (status.st_size == 0) {
+            if (posix_fallocate(fd, 0, static_cast<off_t>(size_)) != 0 || fstat(fd, &status) != 0) {
+                throw std::runtime_error("cannot size shared memory");
+            }
+        }
+        if (static_cast<size_t>(status.st_size) != size_) {
+            throw std::runtime_error("shared memory holds a bucket with another layout");
+        }
+        auto mapping = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("cannot map shared memory");
+        }
+        segment_ = static_cast<shared_segment*>(mapping);
+        // the memory reads as zeros until one process claims it
+        uint32_t empty = 0;
+        if (segment_->ready.compare_exchange_strong(empty, 1, std::memory_order_acq_rel)) {
+            // the ledger is already clear
+            const shared_segment fresh;
+            std::memcpy(segment_->magic, fresh.magic, sizeof(fresh.magic));
+            segment_->version = fresh.version;
+            segment_->block_size = block_size;
+            segment_->block_count = block_count;
+            segment_->ledger_offset = ledger_offset;
+            segment_->data_offset = data_offset;
+            // blocks past the end of the last word are never free
+            if (const auto tail = block_count % shared_segment::word_bits; tail != 0) {
+                segment_->ledger()[block_count / shared_segment::word_bits].store(~uint64_t{0} << tail, std::memory_order_relaxed);
+            }
+            segment_->ready.store(2, std::memory_order_release);
+            return;
+        }
+        try {
+            wait_for([&] { return segment_->ready.load(std::memory_order_acquire) == 2; });
+        } catch (...) {
+            munmap(segment_, size_);
+            throw;
+        }
+        if (std::memcmp(segment_->magic, shared_segment{}.magic, sizeof(segment_->magic)) != 0
+            || segment_->block_size != block_size || segment_->block_count != block_count) {
+            munmap(segment_, size_);
+            throw std::runtime_error("shared memory holds a bucket with another layout");
+        }
+    }
+
+    // the initializing process is given a second
+    template<typename F>
+    static void wait_for(F&& done) {
+        for (int i = 0; !done(); ++i) {
+            if (i == 1000) {
+                throw std::runtime_error("shared memory was not initialized in time");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    shared_segment* segment_{nullptr};
+    size_t size_{0};
+};
+
+// Allocator over a shared_bucket. It refers to the segment with an
+// offset_ptr, so a container constructed inside the shared memory (and
+// its allocator with it) is usable from every process that maps it
+template<typename T>
+class SharedPoolAllocator {
+public:
+    typedef T                   value_type;
+    typedef offset_ptr<T>       pointer;
+
+    template<typename U>
+    struct rebind{ using other = SharedPoolAllocator<U>; };
+
+    template<typename U>
+    friend class SharedPoolAllocator;
+
+    SharedPoolAllocator(shared_bucket& bucket) : segment_(&bucket.segment()) {}
+
+    SharedPoolAllocator(const SharedPoolAllocator& other) : segment_(other.segment_) {}
+
+    template<typename U>
+    SharedPoolAllocator(const SharedPoolAllocator<U>& other) : segment_(other.segment_) {}
+
+    pointer allocate(size_t n) {
+        if (auto ptr = segment_->allocate(n * sizeof(T)); ptr != nullptr) {
+            return pointer(static_cast<T*>(ptr));
+        }
+        throw std::bad_alloc{};
+    }
+
+    void deallocate(pointer ptr, size_t n) {
+        segment_->deallocate(std::to_address(ptr), n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const SharedPoolAllocator<U>& other) const {
+        return segment_ == other.segment_;
+    }
+
+private:
+    offset_ptr<shared_segment> segment_;
+};
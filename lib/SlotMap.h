@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "MemoryPoolAllocator.h"
+
+
+// 64 bit handle of a slot_map element: the slot and the generation of
+// the slot when the element was inserted. A handle outlives its element
+// safely, once the element is erased the generation of the slot moves on
+// and the handle no longer finds anything, even after the slot is reused
+struct slot_handle {
+    uint32_t index{0};
+    uint32_t generation{0};
+
+    bool operator==(const slot_handle&) const = default;
+};
+
+// Table with stable handles over a bucket with blocks of sizeof(T).
+// The elements are kept packed at the front of the bucket, in blocks
+// 0 to size() - 1, and a table maps every slot to the block of its
+// element, so iteration walks size() adjacent elements whatever slots
+// they were given. Erase moves the last element into the block of the
+// erased one, so T has to be move assignable and a pointer to an element
+// lasts only until the next erase, a handle lasts as long as the element.
+// Insert reuses the last erased slot first. Insert, erase and lookup are O(1)
+template<typename T>
+class slot_map {
+public:
+    typedef T value_type;
+
+    class iterator {
+    public:
+        typedef std::forward_iterator_tag   iterator_category;
+        typedef T                           value_type;
+        typedef std::ptrdiff_t              difference_type;
+        typedef T*                          pointer;
+        typedef T&                          reference;
+
+        iterator() = default;
+
+        iterator(const slot_map* map, size_t dense) : map_(map), dense_(dense) {}
+
+        T& operator*() const { return *map_->element(dense_); }
+        T* operator->() const { return map_->element(dense_); }
+
+        iterator& operator++() {
+            ++dense_;
+            return *this;
+        }
+
+        iterator operator++(int) { auto old = *this; ++*this; return old; }
+
+        bool operator==(const iterator& other) const { return dense_ == other.dense_; }
+
+        // the handle of the element, to keep it after the iteration
+        slot_handle handle() const {
+            const auto slot = map_->slot_of_[dense_];
+            return {slot, map_->slots_[slot].generation};
+        }
+
+    private:
+        const slot_map* map_{nullptr};
+        size_t dense_{0};
+    };
+
+    // the capacity is checked before the bucket maps anything
+    explicit slot_map(size_t capacity, commit_options commit = {})
+        : bucket_(sizeof(T), checked_capacity(capacity), bucket_policy::first_fit, commit)
+        , slots_(capacity)
+        , slot_of_(capacity, 0) {}
+
+    slot_map(const slot_map&) = delete;
+    slot_map& operator=(const slot_map&) = delete;
+
+    ~slot_map() {
+        clear();
+    }
+
+    // throws bad_alloc when every slot is taken
+    template<typename... Args>
+    slot_handle emplace(Args&&... args) {
+        if (size_ == capacity()) {
+            throw std::bad_alloc{};
+        }
+        // the block right after the last element
+        const auto dense = size_;
+        bucket_.claim(dense);
+        try {
+            std::construct_at(element(dense), std::forward<Args>(args)...);
+        } catch (...) {
+            bucket_.deallocate(bucket_.block(dense), sizeof(T));
+            throw;
+        }
+        uint32_t slot;
+        if (!free_slots_.empty()) {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        } else {
+            // every slot below is either taken or in free_slots_
+            slot = static_cast<uint32_t>(size_);
+        }
+        // odd while the slot holds an element
+        ++slots_[slot].generation;
+        slots_[slot].dense = static_cast<uint32_t>(dense);
+        slot_of_[dense] = slot;
+        ++size_;
+        return {slot, slots_[slot].generation};
+    }
+
+    slot_handle insert(const T& value) {
+        return emplace(value);
+    }
+
+    slot_handle insert(T&& value) {
+        return emplace(std::move(value));
+    }
+
+    // false when the handle is stale. The last element moves into the
+    // block of the erased one
+    bool erase(slot_handle handle) {
+        if (!contains(handle)) {
+            return false;
+        }
+        const auto dense = slots_[handle.index].dense;
+        const auto last = size_ - 1;
+        if (dense != last) {
+            *element(dense) = std::move(*element(last));
+            slot_of_[dense] = slot_of_[last];
+            slots_[slot_of_[dense]].dense = dense;
+        }
+        std::destroy_at(element(last));
+        bucket_.deallocate(bucket_.block(last), sizeof(T));
+        ++slots_[handle.index].generation;
+        free_slots_.push_back(handle.index);
+        --size_;
+        return true;
+    }
+
+    bool contains(slot_handle handle) const {
+        return handle.index < slots_.size() && slots_[handle.index].generation == handle.generation
+            && (handle.generation & 1) != 0;
+    }
+
+    // nullptr when the handle is stale
+    T* find(slot_handle handle) const {
+        return contains(handle) ? element(slots_[handle.index].dense) : nullptr;
+    }
+
+    T& at(slot_handle handle) const {
+        if (auto element = find(handle)) {
+            return *element;
+        }
+        throw std::out_of_range("stale slot_map handle");
+    }
+
+    void clear() {
+        for (size_t dense = 0; dense < size_; ++dense) {
+            std::destroy_at(element(dense));
+            ++slots_[slot_of_[dense]].generation;
+        }
+        bucket_.reset();
+        // slots are given out from 0 again, their generations keep the
+        // handles of the cleared elements stale
+        free_slots_.clear();
+        size_ = 0;
+    }
+
+    iterator begin() const { return {this, 0}; }
+    iterator end() const { return {this, size_}; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return bucket_.BlockCount; }
+
+private:
+    struct slot {
+        // block of the element while the slot holds one
+        uint32_t dense{0};
+        // odd while the slot holds an element, counts up on insert and erase
+        uint32_t generation{0};
+    };
+
+    static size_t checked_capacity(size_t capacity) {
+        if (capacity > UINT32_MAX) {
+            throw std::length_error("slot_map handles address 2^32 slots");
+        }
+        return capacity;
+    }
+
+    T* element(size_t dense) const {
+        return static_cast<T*>(bucket_.block(dense));
+    }
+
+    bucket bucket_;
+    std::vector<slot> slots_;
+    // slot of the element in every block below size_
+    std::vector<uint32_t> slot_of_;
+    // erased slots, the last one is reused first
+    std::vector<uint32_t> free_slots_;
+    size_t size_{0};
+};
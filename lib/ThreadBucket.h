@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include "MemoryPoolAllocator.h"
+
+
+// A bucket owned by one thread that other threads may free into. Only
+// the owner allocates and touches the ledger; a free from any other
+// thread pushes the run onto a lock-free remote free list kept inside the
+// freed blocks (block index and block count, 8 bytes), and the owner
+// drains that list into the ledger in one go before its next
+// allocation. So the ledger is never shared between threads, and a free
+// from another thread costs one compare and swap on the list head.
+// Blocks must hold 8 bytes, be a multiple of 4 bytes so the list entry
+// is aligned in every block, and the bucket at most 2^32 - 1 blocks
+class thread_bucket {
+public:
+    thread_bucket(size_t block_size, size_t block_count, bucket_policy policy = bucket_policy::first_fit,
+                  commit_options commit = {})
+        : bucket_(block_size, block_count, policy, commit) {
+        if (block_size < sizeof(remote_free) || block_size % alignof(remote_free) != 0 || block_count >= UINT32_MAX
+            || policy == bucket_policy::bump) {
+            throw std::invalid_argument(
+                "thread_bucket needs blocks of 8 bytes or more in steps of 4, fewer than 2^32 blocks and a policy that frees");
+        }
+    }
+
+    thread_bucket(const thread_bucket&) = delete;
+    thread_bucket& operator=(const thread_bucket&) = delete;
+
+    // owner only, nullptr when the bucket is full
+    void* allocate(size_t bytes) {
+        if (remote_head_.load(std::memory_order_relaxed) != 0) {
+            drain();
+        }
+        return bucket_.allocate(bytes);
+    }
+
+    // any thread
+    void deallocate(void* ptr, size_t bytes) {
+        // only the owner finds its own id here, and it stored that itself
+        if (std::this_thread::get_id() == owner_.load(std::memory_order_relaxed)) {
+            bucket_.deallocate(ptr, bytes);
+            return;
+        }
+        const auto index = bucket_.index_of(ptr);
+        auto node = static_cast<remote_free*>(ptr);
+        node->blocks = static_cast<uint32_t>(bucket_.capacity_for(bytes) / bucket_.BlockSize);
+        node->next = remote_head_.load(std::memory_order_relaxed);
+        // the node is written before it is published
+        while (!remote_head_.compare_exchange_weak(node->next, static_cast<uint32_t>(index + 1),
+                                                   std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    // owner only, frees the runs other threads gave back, returns how many
+    size_t drain() {
+        auto head = remote_head_.exchange(0, std::memory_order_acquire);
+        size_t drained = 0;
+        while (head != 0) {
+            auto block = bucket_.block(head - 1);
+            const auto node = *static_cast<remote_free*>(block);
+            bucket_.deallocate(block, node.blocks * bucket_.BlockSize);
+            head = node.next;
+            ++drained;
+        }
+        return drained;
+    }
+
+    // hands the bucket to the calling thread, the previous owner must
+    // not allocate or free from then on. Other threads may keep freeing
+    void adopt() {
+        owner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    }
+
+    bool belongs(void* ptr) const {
+        return bucket_.belongs(ptr);
+    }
+
+    bucket& storage() {
+        return bucket_;
+    }
+
+private:
+    // written over the first 8 bytes of a run freed by another thread
+    struct remote_free {
+        // index + 1 of the next freed run, 0 ends the list
+        uint32_t next;
+        uint32_t blocks;
+    };
+
+    bucket bucket_;
+    std::atomic<std::thread::id> owner_{std::this_thread::get_id()};
+    // index + 1 of the first block of the last run freed remotely
+    alignas(64) std::atomic<uint32_t> remote_head_{0};
+};
+
+// Allocator over a thread_bucket, for containers that are built on the
+// owning thread and may be destroyed on another one
+template<typename T>
+class ThreadBucketAllocator {
+public:
+    typedef T                   value_type;
+    typedef value_type*         pointer;
+
+    template<typename U>
+    struct rebind{ using other = ThreadBucketAllocator<U>; };
+
+    template<typename U>
+    friend class ThreadBucketAllocator;
+
+    ThreadBucketAllocator(thread_bucket& bucket) : bucket_(&bucket) {}
+
+    template<typename U>
+    ThreadBucketAllocator(const ThreadBucketAllocator<U>& other) : bucket_(other.bucket_) {}
+
+    pointer allocate(size_t n) {
+        if (auto ptr = bucket_->allocate(n * sizeof(T)); ptr != nullptr) {
+            return static_cast<pointer>(ptr);
+        }
+        throw std::bad_alloc{};
+    }
+
+    void deallocate(pointer ptr, size_t n) {
+        bucket_->deallocate(ptr, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const ThreadBucketAllocator<U>& other) const {
+        return bucket_ == other.bucket_;
+    }
+
+private:
+    thread_bucket* bucket_;
+};
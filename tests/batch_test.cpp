@@ -0,0 +1,92 @@
+#include "test_common.h"
+#include "../lib/MemoryPoolAllocator.h"
+#include "../lib/PoolPtr.h"
+#include <vector>
+
+// allocate_batch fills out completely or not at all, whatever the bucket
+// policies and with frees ignored, and deallocate_batch gives it all back
+
+namespace {
+
+template<typename Alloc, typename Pointer>
+bool batch_fails(Alloc& alloc, size_t n, size_t count, Pointer* out) {
+    try {
+        alloc.allocate_batch(n, count, out);
+    } catch (const std::bad_alloc&) {
+        return true;
+    }
+    return false;
+}
+
+void fill_and_free() {
+    std::array<bucket, 2> pool{bucket(8, 100), bucket(16, 100, bucket_policy::next_fit)};
+    MemoryPoolAllocator<uint64_t, 2> alloc(pool);
+    std::vector<uint64_t*> out(150);
+    alloc.allocate_batch(1, out.size(), out.data());
+    CHECK(pool[0].free_blocks() == 0 && pool[1].free_blocks() == 50);
+    for (size_t i = 0; i < out.size(); ++i) {
+        *out[i] = i;
+    }
+    for (size_t i = 0; i < out.size(); ++i) {
+        CHECK(*out[i] == i);
+    }
+    alloc.deallocate_batch(out.data(), out.size(), 1);
+    CHECK(pool[0].free_blocks() == 100 && pool[1].free_blocks() == 100);
+}
+
+// a batch that does not fit leaves every bucket as it was
+void all_or_nothing() {
+    std::array<bucket, 2> pool{bucket(8, 100), bucket(16, 100, bucket_policy::bump)};
+    MemoryPoolAllocator<uint64_t, 2> alloc(pool);
+    std::vector<uint64_t*> out(300);
+    CHECK(batch_fails(alloc, 1, out.size(), out.data()));
+    CHECK(pool[0].free_blocks() == 100 && pool[1].free_blocks() == 100);
+    // also while frees are ignored, when deallocate does nothing
+    alloc.ignore_frees(true);
+    CHECK(batch_fails(alloc, 1, out.size(), out.data()));
+    CHECK(pool[0].free_blocks() == 100 && pool[1].free_blocks() == 100);
+    alloc.ignore_frees(false);
+}
+
+// runs of several blocks
+void runs() {
+    std::array<bucket, 1> pool{bucket(16, 64)};
+    MemoryPoolAllocator<uint64_t, 1> alloc(pool);
+    std::vector<uint64_t*> out(16);
+    alloc.allocate_batch(8, out.size(), out.data());
+    CHECK(pool[0].free_blocks() == 0);
+    for (size_t i = 1; i < out.size(); ++i) {
+        CHECK(out[i] - out[i - 1] >= 8 || out[i - 1] - out[i] >= 8);
+    }
+    alloc.deallocate_batch(out.data(), out.size(), 8);
+    CHECK(pool[0].free_blocks() == 64);
+}
+
+// fancy pointers are made after the runs are claimed, a run the pointer
+// can not reach fails the batch and the runs go back
+void fancy_pointers() {
+    std::array<bucket, 1> pool{bucket(8, 100)};
+    MemoryPoolAllocator<uint64_t, 1, pool_ptr<uint64_t>> alloc(pool);
+    std::vector<pool_ptr<uint64_t>> out(10);
+    CHECK(batch_fails(alloc, 1, out.size(), out.data()));
+    CHECK(pool[0].free_blocks() == 100);
+    register_pool(pool);
+    alloc.allocate_batch(1, out.size(), out.data());
+    CHECK(pool[0].free_blocks() == 90);
+    for (const auto& ptr : out) {
+        CHECK(pool[0].belongs(ptr.get()));
+    }
+    alloc.deallocate_batch(out.data(), out.size(), 1);
+    CHECK(pool[0].free_blocks() == 100);
+    unregister_bucket(pool[0]);
+}
+
+}
+
+int main() {
+    fill_and_free();
+    all_or_nothing();
+    runs();
+    fancy_pointers();
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include "test_common.h"
+#include "../lib/EpochReclaimer.h"
+#include "../lib/PerCpuCache.h"
+#include "../lib/SharedBucket.h"
+#include "../lib/ThreadBucket.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/wait.h>
+
+// The structures that are shared between threads or processes, run
+// from several threads at once. Every block carries the tag of the
+// thread that holds it, a block handed to two holders fails the check.
+// Build with -DSANITIZE=thread to have the races looked for as well
+
+namespace {
+
+constexpr size_t threads = 4;
+
+void run_threads(size_t count, const std::function<void(size_t)>& body) {
+    std::vector<std::thread> running;
+    for (size_t t = 0; t < count; ++t) {
+        running.emplace_back(body, t);
+    }
+    for (auto& thread : running) {
+        thread.join();
+    }
+}
+
+// Treiber stack whose popped nodes are retired through an epoch_domain
+void epoch_stack() {
+    struct node {
+        uint64_t value;
+        node* next;
+    };
+    std::array<bucket, 1> pool{bucket(sizeof(node), 1 << 16)};
+    std::mutex pool_lock;
+    MemoryPoolAllocator<node, 1> alloc(pool);
+    std::atomic<node*> head{nullptr};
+    std::atomic<uint64_t> pushed{0};
+    std::atomic<uint64_t> popped{0};
+    {
+        epoch_domain<1> domain(alloc, pool_lock, 32);
+        run_threads(threads, [&](size_t t) {
+            epoch_participant<1> self(domain);
+            for (uint64_t i = 0; i < 5000; ++i) {
+                node* fresh;
+                {
+                    std::lock_guard guard(pool_lock);
+                    fresh = alloc.allocate(1);
+                }
+                fresh->value = t * 1000000 + i;
+                fresh->next = head.load(std::memory_order_relaxed);
+                while (!head.compare_exchange_weak(fresh->next, fresh, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {}
+                pushed.fetch_add(fresh->value, std::memory_order_relaxed);
+
+                auto guard = self.pin();
+                auto top = head.load(std::memory_order_acquire);
+                while (top != nullptr && !head.compare_exchange_weak(top, top->next, std::memory_order_acquire,
+                                                                      std::memory_order_acquire)) {}
+                if (top != nullptr) {
+                    popped.fetch_add(top->value, std::memory_order_relaxed);
+                    self.retire(top);
+                }
+            }
+        });
+        // what is left is unreachable once the threads are gone
+        for (auto top = head.load(); top != nullptr;) {
+            popped += top->value;
+            const auto next = top->next;
+            alloc.deallocate(top, 1);
+            top = next;
+        }
+    }
+    CHECK(pushed.load() == popped.load());
+    CHECK(pool[0].free_blocks() == pool[0].BlockCount);
+}
+
+// messages allocated by the owner and freed by consumers on other
+// threads, the producer adopts the bucket while consumers already wait
+void thread_bucket_messages() {
+    thread_bucket owned(64, 1 << 12);
+    std::mutex queue_lock;
+    std::condition_variable ready;
+    std::deque<uint64_t*> queue;
+    bool done = false;
+    std::vector<std::thread> consumers;
+    for (size_t t = 0; t < threads - 1; ++t) {
+        consumers.emplace_back([&] {
+            while (true) {
+                std::unique_lock lock(queue_lock);
+                ready.wait(lock, [&] { return done || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                auto message = queue.front();
+                queue.pop_front();
+                lock.unlock();
+                CHECK(message[1] == ~message[0]);
+                owned.deallocate(message, 64);
+            }
+        });
+    }
+    std::thread([&] {
+        owned.adopt();
+        for (uint64_t i = 0; i < 50000; ++i) {
+            auto message = static_cast<uint64_t*>(owned.allocate(64));
+            if (message == nullptr) {
+                // every block is in flight, the consumers give them back
+                std::this_thread::yield();
+                continue;
+            }
+            message[0] = i;
+            message[1] = ~i;
+            {
+                std::lock_guard lock(queue_lock);
+                queue.push_back(message);
+            }
+            ready.notify_one();
+        }
+        {
+            std::lock_guard lock(queue_lock);
+            done = true;
+        }
+        ready.notify_all();
+        for (auto& consumer : consumers) {
+            consumer.join();
+        }
+        owned.drain();
+    }).join();
+    CHECK(owned.storage().free_blocks() == owned.storage().BlockCount);
+}
+
+void percpu_churn() {
+    bucket shared(64, 1 << 14);
+    std::mutex lock;
+    {
+        percpu_cache<> cache(shared, lock, 64);
+        run_threads(threads, [&](size_t t) {
+            std::vector<uint64_t*> held;
+            for (int round = 0; round < 500; ++round) {
+                for (int i = 0; i < 40; ++i) {
+                    auto block = static_cast<uint64_t*>(cache.allocate());
+                    CHECK(block != nullptr);
+                    block[0] = t;
+                    held.push_back(block);
+                }
+                for (auto block : held) {
+                    CHECK(block[0] == t);
+                    cache.deallocate(block);
+                }
+                held.clear();
+            }
+        });
+    }
+    CHECK(shared.free_blocks() == shared.BlockCount);
+}
+
+// threads of this process and a second process allocate from one memfd
+void shared_bucket_processes() {
+    const int fd = memfd_create("concurrency_test", 0);
+    CHECK(fd >= 0);
+    const auto child = fork();
+    if (child == 0) {
+        shared_bucket attached(fd, 64, 1 << 12);
+        std::vector<uint64_t*> held;
+        for (int i = 0; i < 1000; ++i) {
+            if (auto block = static_cast<uint64_t*>(attached.allocate(64 * (1 + i % 3)))) {
+                block[0] = 1;
+                held.push_back(block);
+            }
+        }
+        int status = 0;
+        for (size_t i = 0; i < held.size(); ++i) {
+            status |= held[i][0] != 1;
+            attached.deallocate(held[i], 64 * (1 + i % 3));
+        }
+        _exit(status);
+    }
+    {
+        shared_bucket bucket(fd, 64, 1 << 12);
+        run_threads(threads, [&](size_t t) {
+            std::vector<std::pair<uint64_t*, size_t>> held;
+            const auto release = [&] {
+                const auto [block, bytes] = held.front();
+                CHECK(block[0] == t + 2 && block[bytes / 8 - 1] == t + 2);
+                bucket.deallocate(block, bytes);
+                held.erase(held.begin());
+            };
+            for (int i = 0; i < 1000; ++i) {
+                // runs of more than a ledger word now and then
+                const size_t bytes = i % 100 == 0 ? 64 * 80 : 64 * (1 + i % 3);
+                if (auto block = static_cast<uint64_t*>(bucket.allocate(bytes))) {
+                    block[0] = t + 2;
+                    block[bytes / 8 - 1] = t + 2;
+                    held.emplace_back(block, bytes);
+                    if (held.size() > 64) {
+                        release();
+                    }
+                }
+            }
+            while (!held.empty()) {
+                release();
+            }
+        });
+        int status = 0;
+        CHECK(waitpid(child, &status, 0) == child);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        CHECK(bucket.free_blocks() == (1 << 12));
+    }
+    close(fd);
+}
+
+}
+
+int main() {
+    epoch_stack();
+    thread_bucket_messages();
+    percpu_churn();
+    shared_bucket_processes();
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "test_common.h"
+#include "../lib/MemoryPoolAllocator.h"
+#include "../lib/PoolVector.h"
+#include <random>
+#include <vector>
+
+// Pages of a bucket with decommit on are released only when no used
+// block is left on them, however the runs on them were split or grown
+
+namespace {
+
+constexpr decommit_options eager{0, false, false};
+
+// a run that is shrunk keeps its head, the page under it stays committed
+void shrink_keeps_head() {
+    bucket b(16, 4096, bucket_policy::first_fit, {commit_mode::lazy});
+    b.enable_decommit(eager);
+    auto head = static_cast<uint8_t*>(b.allocate(64));
+    std::memset(head, 0x5A, 64);
+    CHECK(b.try_shrink(head, 64, 16));
+    b.deallocate(b.allocate(16), 16);
+    CHECK(b.decommitted_pages() == 0);
+    for (size_t i = 0; i < 16; ++i) {
+        CHECK(head[i] == 0x5A);
+    }
+}
+
+// a run that is expanded is released as a whole once freed
+void expand_then_free() {
+    bucket b(16, 4096, bucket_policy::first_fit, {commit_mode::lazy});
+    b.enable_decommit(eager);
+    auto run = b.allocate(16);
+    CHECK(b.try_expand(run, 16, 64));
+    b.deallocate(run, 64);
+    CHECK(b.decommitted_pages() == 1);
+}
+
+void vector_shrink_to_fit() {
+    std::array<bucket, 1> pool{bucket(8, 4096, bucket_policy::first_fit, {commit_mode::lazy})};
+    pool[0].enable_decommit(eager);
+    MemoryPoolAllocator<int, 1> alloc(pool);
+    pool_vector<int, 1> v(alloc);
+    for (int i = 0; i < 10; ++i) {
+        v.push_back(i + 1);
+    }
+    v.shrink_to_fit();
+    alloc.deallocate(alloc.allocate(1), 1);
+    CHECK(pool[0].decommitted_pages() == 0);
+    for (int i = 0; i < 10; ++i) {
+        CHECK(v[i] == i + 1);
+    }
+}
+
+// random runs that are shrunk, expanded and freed, with blocks that
+// straddle pages; every live byte keeps its pattern
+void fuzz(size_t block_size, bool deferred) {
+    bucket b(block_size, 2000, bucket_policy::first_fit, {commit_mode::lazy});
+    b.enable_decommit({0, false, deferred});
+    struct run {
+        uint8_t* ptr;
+        size_t bytes;
+        uint8_t tag;
+    };
+    std::vector<run> live;
+    std::mt19937 rng(7);
+    const auto verify = [&] {
+        for (const auto& r : live) {
+            for (size_t i = 0; i < r.bytes; ++i) {
+                CHECK(r.ptr[i] == r.tag);
+            }
+        }
+    };
+    for (int step = 0; step < 4000; ++step) {
+        const auto op = rng() % 5;
+        if (op <= 1 || live.empty()) {
+            const auto bytes = 1 + rng() % (block_size * 8);
+            if (auto ptr = static_cast<uint8_t*>(b.allocate(bytes))) {
+                const auto tag = static_cast<uint8_t>(1 + rng() % 255);
+                std::memset(ptr, tag, bytes);
+                live.push_back({ptr, bytes, tag});
+            }
+        } else {
+            const auto victim = rng() % live.size();
+            auto& r = live[victim];
+            if (op == 2) {
+                b.deallocate(r.ptr, r.bytes);
+                live.erase(live.begin() + static_cast<long>(victim));
+            } else if (op == 3) {
+                const auto bytes = 1 + rng() % r.bytes;
+                CHECK(b.try_shrink(r.ptr, r.bytes, bytes));
+                r.bytes = bytes;
+            } else {
+                const auto bytes = r.bytes + 1 + rng() % (block_size * 4);
+                if (b.try_expand(r.ptr, r.bytes, bytes)) {
+                    std::memset(r.ptr + r.bytes, r.tag, bytes - r.bytes);
+                    r.bytes = bytes;
+                }
+            }
+        }
+        if (step % 50 == 0) {
+            b.maintain();
+            verify();
+        }
+    }
+    verify();
+}
+
+}
+
+int main() {
+    shrink_keeps_head();
+    expand_then_free();
+    vector_shrink_to_fit();
+    for (auto block_size : {16, 48, 3000, 5000}) {
+        fuzz(block_size, false);
+        fuzz(block_size, true);
+    }
+    return 0;
+}
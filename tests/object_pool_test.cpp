@@ -0,0 +1,102 @@
+#include "test_common.h"
+#include "../lib/ObjectPool.h"
+#include <stdexcept>
+#include <string>
+
+// ObjectPool reuses the last destroyed slot, constructs from the args of
+// create, and keeps its slots when a constructor throws
+
+namespace {
+
+struct counted {
+    static inline int alive = 0;
+    std::string name;
+
+    explicit counted(std::string n, bool fail = false) : name(std::move(n)) {
+        if (fail) {
+            throw std::runtime_error("constructor failed");
+        }
+        ++alive;
+    }
+
+    ~counted() {
+        --alive;
+    }
+};
+
+template<typename Pool>
+bool create_throws(Pool& pool) {
+    try {
+        pool.create("failing", true);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void reuse_and_args() {
+    ObjectPool<counted> pool(4);
+    auto a = pool.create("a");
+    auto b = pool.create("b");
+    CHECK(pool.size() == 2 && counted::alive == 2);
+    pool.destroy(a);
+    CHECK(counted::alive == 1);
+    auto c = pool.create("c");
+    // the last destroyed slot comes back first
+    CHECK(c == a);
+    CHECK(c->name == "c");
+    CHECK(create_throws(pool));
+    CHECK(pool.size() == 2);
+    pool.destroy(b);
+    pool.destroy(c);
+    pool.shrink();
+    CHECK(pool.cached() == 0 && pool.storage().free_blocks() == 4);
+    CHECK(counted::alive == 0);
+}
+
+void full() {
+    ObjectPool<int> pool(2);
+    pool.create(1);
+    pool.create(2);
+    bool threw = false;
+    try {
+        pool.create(3);
+    } catch (const std::bad_alloc&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+void recycling() {
+    {
+        ObjectPool<counted, true> pool(4);
+        CHECK(pool.recycled() == nullptr);
+        auto a = pool.create("a");
+        pool.destroy(a);
+        // a recycled object is kept constructed and handed back as it was
+        CHECK(counted::alive == 1 && pool.cached() == 1);
+        auto again = pool.recycled();
+        CHECK(again == a && again->name == "a");
+        pool.destroy(again);
+        // create constructs from its args even over a cached object
+        auto b = pool.create("b");
+        CHECK(b == a && b->name == "b" && counted::alive == 1);
+        pool.destroy(b);
+        // a throw leaves the slot empty and back in the bucket
+        CHECK(create_throws(pool));
+        CHECK(pool.cached() == 0 && counted::alive == 0);
+        CHECK(pool.storage().free_blocks() == 4);
+        pool.destroy(pool.create("c"));
+    }
+    // cached objects are destroyed with the pool
+    CHECK(counted::alive == 0);
+}
+
+}
+
+int main() {
+    reuse_and_args();
+    full();
+    recycling();
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "test_common.h"
+#include "../lib/MemoryPoolAllocator.h"
+#include "../lib/OffsetPtr.h"
+#include <filesystem>
+#include <string>
+
+// A persistent pool is written, closed and reopened at another address,
+// the objects are found again from the root through their offset_ptr
+// links, a large allocation included
+
+namespace {
+
+struct node {
+    uint64_t value;
+    offset_ptr<node> next;
+};
+
+struct table_root {
+    offset_ptr<node> head;
+    offset_ptr<uint64_t> large;
+    uint64_t large_count;
+};
+
+constexpr size_t nodes = 1000;
+// 2 MiB, past the default large threshold
+constexpr size_t large_count = (size_t{2} << 20) / sizeof(uint64_t);
+
+std::array<bucket, 1> open_pool(const std::string& path) {
+    return {bucket(path, 64, 65536)};
+}
+
+void write(const std::string& path) {
+    auto pool = open_pool(path);
+    MemoryPoolAllocator<node, 1, offset_ptr<node>> alloc(pool);
+    MemoryPoolAllocator<table_root, 1, offset_ptr<table_root>> roots(alloc);
+    MemoryPoolAllocator<uint64_t, 1, offset_ptr<uint64_t>> words(alloc);
+    CHECK(pool[0].root() == nullptr);
+
+    auto root = std::to_address(roots.allocate(1));
+    std::construct_at(root);
+    for (uint64_t i = 0; i < nodes; ++i) {
+        auto fresh = std::to_address(alloc.allocate(1));
+        std::construct_at(fresh, node{i * 7, root->head});
+        root->head = fresh;
+    }
+    root->large = words.allocate(large_count);
+    root->large_count = large_count;
+    CHECK(pool[0].belongs(root->large.get()));
+    for (size_t i = 0; i < large_count; ++i) {
+        root->large[static_cast<std::ptrdiff_t>(i)] = i ^ 0x5A5A;
+    }
+    pool[0].set_root(root);
+    pool[0].sync();
+}
+
+void reopen(const std::string& path, size_t used_blocks) {
+    // keeps the address the pool had free, so it is likely mapped elsewhere
+    const auto size = static_cast<size_t>(std::filesystem::file_size(path));
+    void* placeholder = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    auto pool = open_pool(path);
+    munmap(placeholder, size);
+    CHECK(pool[0].BlockCount - pool[0].free_blocks() == used_blocks);
+
+    auto root = static_cast<table_root*>(pool[0].root());
+    CHECK(root != nullptr);
+    size_t seen = 0;
+    for (auto n = root->head; n; n = n->next) {
+        CHECK(pool[0].belongs(n.get()));
+        CHECK(n->value == (nodes - 1 - seen) * 7);
+        ++seen;
+    }
+    CHECK(seen == nodes);
+    CHECK(root->large_count == large_count);
+    CHECK(pool[0].belongs(root->large.get()));
+    for (size_t i = 0; i < large_count; ++i) {
+        CHECK(root->large[static_cast<std::ptrdiff_t>(i)] == (i ^ 0x5A5A));
+    }
+
+    // blocks freed after the reopen are found by the next allocation
+    MemoryPoolAllocator<uint64_t, 1, offset_ptr<uint64_t>> words(pool);
+    words.deallocate(root->large, large_count);
+    root->large = words.allocate(large_count);
+    CHECK(pool[0].belongs(root->large.get()));
+}
+
+// a request that no bucket can hold is refused instead of being mapped
+// outside the file
+void too_large(const std::string& path) {
+    auto pool = open_pool(path);
+    MemoryPoolAllocator<uint64_t, 1, offset_ptr<uint64_t>> words(pool);
+    bool refused = false;
+    try {
+        words.allocate(size_t{8} << 20);
+    } catch (const std::bad_alloc&) {
+        refused = true;
+    }
+    CHECK(refused);
+}
+
+}
+
+int main() {
+    const auto path = (std::filesystem::temp_directory_path() / ("persistent_test." + std::to_string(getpid()))).string();
+    std::filesystem::remove(path);
+    write(path);
+    const size_t used_blocks = 1 + nodes + (large_count * sizeof(uint64_t)) / 64;
+    reopen(path, used_blocks);
+    reopen(path, used_blocks);
+    too_large(path);
+    std::filesystem::remove(path);
+    return 0;
+}
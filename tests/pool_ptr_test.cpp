@@ -0,0 +1,94 @@
+#include "test_common.h"
+#include "../lib/PoolPtr.h"
+#include <cstring>
+
+// pool_ptr positions at the edges of the 28 bit field, arithmetic that
+// would carry into the bucket id, and unencodable addresses
+
+namespace {
+
+constexpr std::ptrdiff_t last_index = (std::ptrdiff_t{1} << 28) - 2;
+
+// 256 MB committed on use, one unit of char per byte
+std::array<bucket, 2> pool{bucket(64, 1 << 22, bucket_policy::first_fit, {commit_mode::lazy}),
+                           bucket(16, 64)};
+
+template<typename F>
+bool throws_out_of_range(F&& f) {
+    try {
+        f();
+    } catch (const std::out_of_range&) {
+        return true;
+    }
+    return false;
+}
+
+void edge() {
+    const auto first = reinterpret_cast<char*>(pool[0].data());
+    pool_ptr<char> last(first + last_index);
+    CHECK(last.get() == first + last_index);
+    CHECK((last - last_index).get() == first);
+    CHECK(throws_out_of_range([&] { return last + 1; }));
+    CHECK(throws_out_of_range([&] { auto p = last; return ++p; }));
+    CHECK(throws_out_of_range([&] { return last - last_index - 1; }));
+    // the pointer that threw is unchanged
+    auto p = last;
+    CHECK(throws_out_of_range([&] { p += 1; }));
+    CHECK(p == last);
+    // past the last position an address has no encoding at all
+    CHECK(throws_out_of_range([&] { return pool_ptr<char>(first + last_index + 1); }));
+}
+
+void arithmetic() {
+    const auto words = reinterpret_cast<uint64_t*>(pool[1].data());
+    pool_ptr<uint64_t> p(words);
+    auto q = p + 5;
+    CHECK(q.get() == words + 5);
+    CHECK(q - p == 5);
+    q -= 5;
+    CHECK(q == p);
+    CHECK(p[3] == words[3]);
+    // the second bucket keeps its id through the arithmetic
+    CHECK(pool[1].belongs((p + 7).get()));
+}
+
+void misaligned_and_foreign() {
+    const auto bytes = reinterpret_cast<char*>(pool[1].data());
+    bool rejected = false;
+    try {
+        pool_ptr<uint64_t> p(reinterpret_cast<uint64_t*>(bytes + 4));
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+    uint64_t outside = 0;
+    CHECK(throws_out_of_range([&] { return pool_ptr<uint64_t>(&outside); }));
+    CHECK(!pool_ptr<uint64_t>(nullptr));
+}
+
+// an allocator over a bucket that is not registered can not hand out pool_ptr
+void unregistered_allocation() {
+    std::array<bucket, 1> other{bucket(16, 64)};
+    MemoryPoolAllocator<uint64_t, 1, pool_ptr<uint64_t>> alloc(other);
+    bool refused = false;
+    try {
+        alloc.allocate(1);
+    } catch (const std::bad_alloc&) {
+        refused = true;
+    }
+    CHECK(refused);
+    CHECK(other[0].free_blocks() == 64);
+}
+
+}
+
+int main() {
+    register_pool(pool);
+    edge();
+    arithmetic();
+    misaligned_and_foreign();
+    unregistered_allocation();
+    unregister_bucket(pool[0]);
+    unregister_bucket(pool[1]);
+    return 0;
+}
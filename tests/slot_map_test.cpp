@@ -0,0 +1,107 @@
+#include "test_common.h"
+#include "../lib/SlotMap.h"
+#include <map>
+#include <random>
+#include <string>
+
+// slot_map handles against a reference map: stale handles stay stale
+// after their slot is reused, and iteration visits exactly the elements
+
+namespace {
+
+void stale_after_reuse() {
+    slot_map<std::string> map(8);
+    const auto first = map.insert("first");
+    CHECK(map.erase(first));
+    const auto second = map.insert("second");
+    // the slot is reused with a new generation
+    CHECK(second.index == first.index);
+    CHECK(second.generation != first.generation);
+    CHECK(!map.contains(first));
+    CHECK(map.find(first) == nullptr);
+    CHECK(!map.erase(first));
+    CHECK(map.at(second) == "second");
+    bool threw = false;
+    try {
+        map.at(first);
+    } catch (const std::out_of_range&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+void full_and_cleared() {
+    slot_map<int> map(4);
+    std::vector<slot_handle> handles;
+    for (int i = 0; i < 4; ++i) {
+        handles.push_back(map.insert(i));
+    }
+    bool threw = false;
+    try {
+        map.insert(4);
+    } catch (const std::bad_alloc&) {
+        threw = true;
+    }
+    CHECK(threw);
+    map.clear();
+    CHECK(map.empty());
+    const auto fresh = map.insert(10);
+    for (const auto& handle : handles) {
+        CHECK(!map.contains(handle));
+    }
+    CHECK(map.at(fresh) == 10);
+}
+
+void too_large() {
+    bool threw = false;
+    try {
+        slot_map<int> map(size_t{1} << 33);
+    } catch (const std::length_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+void against_reference() {
+    slot_map<std::string> map(500);
+    std::map<uint64_t, std::pair<slot_handle, std::string>> reference;
+    std::vector<slot_handle> erased;
+    std::mt19937 rng(11);
+    uint64_t key = 0;
+    for (int step = 0; step < 20000; ++step) {
+        if (rng() % 3 != 0 && map.size() < map.capacity()) {
+            auto value = std::to_string(rng()) + std::string(24, '.');
+            reference[key++] = {map.insert(value), value};
+        } else if (!reference.empty()) {
+            auto victim = reference.begin();
+            std::advance(victim, static_cast<long>(rng() % reference.size()));
+            CHECK(map.erase(victim->second.first));
+            erased.push_back(victim->second.first);
+            reference.erase(victim);
+        }
+        if (step % 500 == 0) {
+            size_t visited = 0;
+            for (auto it = map.begin(); it != map.end(); ++it) {
+                CHECK(map.find(it.handle()) == &*it);
+                ++visited;
+            }
+            CHECK(visited == map.size() && visited == reference.size());
+            for (const auto& [_, entry] : reference) {
+                CHECK(map.at(entry.first) == entry.second);
+            }
+            for (const auto& handle : erased) {
+                CHECK(!map.contains(handle));
+            }
+        }
+    }
+}
+
+}
+
+int main() {
+    stale_after_reuse();
+    full_and_cleared();
+    too_large();
+    against_reference();
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "test_common.h"
+#include "../lib/AllocationTrace.h"
+#include "../lib/MemoryPoolAllocator.h"
+#include <filesystem>
+#include <string>
+
+// a trace recorded from an allocator is written and read back unchanged,
+// with sizes past 32 bits, and a pool release ends every live allocation
+
+namespace {
+
+void round_trip(const std::string& path) {
+    std::array<bucket, 2> pool{bucket(8, 1000), bucket(64, 1000)};
+    MemoryPoolAllocator<uint64_t, 2> alloc(pool);
+    trace_recorder recorder;
+    set_trace_recorder(&recorder);
+    auto a = alloc.allocate(1);
+    auto b = alloc.allocate(6);
+    alloc.deallocate(a, 1);
+    auto c = alloc.allocate(3);
+    (void)b;
+    (void)c;
+    // b and c are still live
+    alloc.release_all();
+    set_trace_recorder(nullptr);
+
+    auto events = recorder.events();
+    CHECK(events.size() == 6);
+    size_t allocations = 0;
+    size_t frees = 0;
+    for (const auto& event : events) {
+        (event.kind == trace_event_kind::allocate ? allocations : frees) += 1;
+    }
+    CHECK(allocations == 3 && frees == 3);
+    CHECK(events[0].kind == trace_event_kind::allocate && events[0].size == 8);
+    CHECK(events[2].kind == trace_event_kind::deallocate && events[2].object_id == events[0].object_id);
+
+    // a size that 32 bits do not hold
+    trace_event large;
+    large.object_id = 99;
+    large.size = uint64_t{5} << 32;
+    events.push_back(large);
+    write_trace(path, events);
+    const auto read = read_trace(path);
+    CHECK(read.size() == events.size());
+    for (size_t i = 0; i < read.size(); ++i) {
+        CHECK(read[i].timestamp_ns == events[i].timestamp_ns);
+        CHECK(read[i].object_id == events[i].object_id);
+        CHECK(read[i].size == events[i].size);
+        CHECK(read[i].thread == events[i].thread);
+        CHECK(read[i].kind == events[i].kind);
+    }
+}
+
+void rejects_other_files(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    CHECK(file != nullptr);
+    std::fputs("not a trace at all", file);
+    std::fclose(file);
+    bool rejected = false;
+    try {
+        read_trace(path);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+// allocations past max_live are counted and their frees are not recorded
+void bounded_live() {
+    std::array<bucket, 1> pool{bucket(8, 100)};
+    MemoryPoolAllocator<uint64_t, 1> alloc(pool);
+    trace_recorder recorder(0, 2);
+    set_trace_recorder(&recorder);
+    uint64_t* held[4];
+    for (auto& ptr : held) {
+        ptr = alloc.allocate(1);
+    }
+    for (auto ptr : held) {
+        alloc.deallocate(ptr, 1);
+    }
+    set_trace_recorder(nullptr);
+    CHECK(recorder.untracked() == 2);
+    CHECK(recorder.events().size() == 6);
+}
+
+}
+
+int main() {
+    const auto path = (std::filesystem::temp_directory_path() / ("trace_test." + std::to_string(getpid()))).string();
+    round_trip(path);
+    rejects_other_files(path);
+    bounded_live();
+    std::filesystem::remove(path);
+    return 0;
+}